@@ -0,0 +1,169 @@
+#include "socket_tools.h"
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Load generator for hw1_server: every socket is a separate client, messages
+// are spread over them round robin at a fixed total rate, and keepalive pings
+// are answered like hw1_client does. The send time travels inside the message
+// and comes back in the echo, so round trips are measured without any
+// per-message bookkeeping.
+
+using clock_type = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+constexpr size_t BUF_SIZE = 1000;
+constexpr size_t BATCH_SIZE = 64;
+
+struct stats {
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    uint64_t keepalives = 0;
+    uint64_t send_errors = 0;
+    std::vector<int64_t> rtt_ns;
+};
+
+int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               clock_type::now().time_since_epoch())
+        .count();
+}
+
+struct server_address {
+    sockaddr_storage addr{};
+    socklen_t len = 0;
+
+    const sockaddr* get() const { return reinterpret_cast<const sockaddr*>(&addr); }
+};
+
+void send_message(int sfd, const server_address& server, stats& st)
+{
+    char msg[64];
+    int len = snprintf(msg, sizeof(msg), "m%" PRId64, now_ns());
+    if (sendto(sfd, msg, len, 0, server.get(), server.len) == -1)
+        ++st.send_errors;
+    else
+        ++st.sent;
+}
+
+void drain(int sfd, const server_address& server, dgram_batch& in, stats& st)
+{
+    while (in.recv(sfd) > 0) {
+        int64_t now = now_ns();
+        for (size_t i = 0; i < in.size(); ++i) {
+            char* data = in.data(i);
+            if (data[0] == 'k') {
+                sendto(sfd, data, in.len(i), 0, server.get(), server.len);
+                ++st.keepalives;
+            } else if (data[0] == 'm') {
+                // The reply is "m<send time> too"
+                int64_t sent_at = strtoll(data + 1, nullptr, 10);
+                st.rtt_ns.push_back(now - sent_at);
+                ++st.received;
+            }
+        }
+        if (!in.full())
+            break;
+    }
+}
+
+double percentile_us(const std::vector<int64_t>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t index = std::min(sorted.size() - 1, size_t(p / 100 * sorted.size()));
+    return sorted[index] / 1000.0;
+}
+
+int main(int argc, const char** argv)
+{
+    const char* port = "2024";
+
+    int clients = argc > 1 ? std::atoi(argv[1]) : 64;
+    double rate = argc > 2 ? std::atof(argv[2]) : 10000;
+    double seconds = argc > 3 ? std::atof(argv[3]) : 10;
+    const char* host = argc > 4 ? argv[4] : "localhost";
+    if (clients < 1 || rate <= 0 || seconds <= 0) {
+        printf("Usage: %s [clients] [messages/sec] [seconds] [host]\n", argv[0]);
+        return 1;
+    }
+
+    server_address server;
+    std::vector<pollfd> fds;
+    for (int i = 0; i < clients; ++i) {
+        int sfd = create_dgram_socket(host, port, &server.addr, &server.len);
+        if (sfd == -1) {
+            printf("Cannot create socket %d: %s\n", i, strerror(errno));
+            return 1;
+        }
+        fds.push_back({.fd = sfd, .events = POLLIN});
+    }
+    printf("%d clients, %.0f messages/sec for %.1fs against %s:%s\n",
+           clients, rate, seconds, host, port);
+
+    stats st;
+    st.rtt_ns.reserve(size_t(rate * seconds));
+    dgram_batch in{BATCH_SIZE, BUF_SIZE};
+
+    const auto start = clock_type::now();
+    const auto stop_sending = start + std::chrono::duration<double>(seconds);
+    // Late replies still count, lost ones are whatever is missing after this
+    const auto stop = stop_sending + 500ms;
+    auto next_report = start + 1s;
+    uint64_t reported = 0;
+    size_t next_client = 0;
+
+    for (auto now = start; now < stop; now = clock_type::now()) {
+        if (now < stop_sending) {
+            // Catch up to the schedule, so a slow iteration doesn't lower the rate
+            std::chrono::duration<double> elapsed = now - start;
+            uint64_t due = uint64_t(elapsed.count() * rate);
+            while (st.sent + st.send_errors < due) {
+                send_message(fds[next_client].fd, server, st);
+                next_client = (next_client + 1) % fds.size();
+            }
+        }
+
+        poll(fds.data(), fds.size(), 1);
+        for (auto& p: fds) {
+            if (p.revents & POLLIN)
+                drain(p.fd, server, in, st);
+        }
+
+        if (now >= next_report) {
+            printf("%8" PRIu64 " replies/sec\n", st.received - reported);
+            reported = st.received;
+            next_report += 1s;
+        }
+    }
+
+    for (auto& p: fds) {
+        close(p.fd);
+    }
+
+    std::sort(st.rtt_ns.begin(), st.rtt_ns.end());
+    std::chrono::duration<double> sending = stop_sending - start;
+    printf("sent %" PRIu64 " (%.0f/sec), received %" PRIu64 " (%.0f/sec), lost %.2f%%\n",
+           st.sent,
+           st.sent / sending.count(),
+           st.received,
+           st.received / sending.count(),
+           st.sent ? 100.0 * (st.sent - std::min(st.sent, st.received)) / st.sent : 0.0);
+    printf("send errors %" PRIu64 ", keepalives answered %" PRIu64 "\n",
+           st.send_errors, st.keepalives);
+    printf("rtt us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           percentile_us(st.rtt_ns, 50),
+           percentile_us(st.rtt_ns, 90),
+           percentile_us(st.rtt_ns, 99),
+           percentile_us(st.rtt_ns, 99.9),
+           st.rtt_ns.empty() ? 0.0 : st.rtt_ns.back() / 1000.0);
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Everything the server keeps per client, packed into 16 bytes
+struct client_entry {
+    uint32_t ip; // network byte order, as in sin_addr
+    uint16_t port; // network byte order, as in sin_port
+    uint8_t used;
+    // Keepalives sent since the client was last heard from
+    uint8_t pings;
+    std::chrono::steady_clock::time_point last_seen;
+};
+
+static_assert(sizeof(client_entry) == 16);
+
+// Flat open-addressing table of clients keyed by (ip, port), with linear
+// probing and backward-shift deletion, so there are no tombstones and a lookup
+// touches one or two cache lines. Pointers into the table are invalidated by
+// insert and erase.
+class client_table {
+    static constexpr size_t MIN_CAPACITY = 16;
+
+public:
+    client_entry* find(const sockaddr_in& addr)
+    {
+        if (count_ == 0)
+            return nullptr;
+        const uint32_t ip = addr.sin_addr.s_addr;
+        const uint16_t port = addr.sin_port;
+        for (size_t i = slot_for(ip, port);; i = (i + 1) & mask_) {
+            client_entry& e = entries_[i];
+            if (!e.used)
+                return nullptr;
+            if (e.ip == ip && e.port == port)
+                return &e;
+        }
+    }
+
+    // Returns the entry for addr and whether it was just created. A new entry
+    // has last_seen and pings zeroed.
+    std::pair<client_entry*, bool> insert(const sockaddr_in& addr)
+    {
+        if (client_entry* e = find(addr))
+            return {e, false};
+
+        // Keep the load factor at or below 1/2, probe runs stay short
+        if ((count_ + 1) * 2 > entries_.size())
+            grow();
+
+        client_entry& e = entries_[free_slot(addr.sin_addr.s_addr, addr.sin_port)];
+        e = client_entry{
+            .ip = addr.sin_addr.s_addr,
+            .port = addr.sin_port,
+            .used = 1,
+        };
+        ++count_;
+        return {&e, true};
+    }
+
+    void erase(client_entry* e)
+    {
+        size_t hole = e - entries_.data();
+        // Pull back every entry of the probe run that would not be found past the hole
+        for (size_t i = (hole + 1) & mask_; entries_[i].used; i = (i + 1) & mask_) {
+            size_t home = slot_for(entries_[i].ip, entries_[i].port);
+            if (((i - home) & mask_) >= ((i - hole) & mask_)) {
+                entries_[hole] = entries_[i];
+                hole = i;
+            }
+        }
+        entries_[hole].used = 0;
+        --count_;
+    }
+
+    bool erase(const sockaddr_in& addr)
+    {
+        client_entry* e = find(addr);
+        if (!e)
+            return false;
+        erase(e);
+        return true;
+    }
+
+    size_t size() const { return count_; }
+    size_t capacity() const { return entries_.size(); }
+
+private:
+    // Clients behind one NAT share the ip and differ only in the port, so the
+    // two are mixed together rather than xor'ed (splitmix64 finalizer)
+    static uint64_t hash(uint32_t ip, uint16_t port)
+    {
+        uint64_t x = (uint64_t{ip} << 16) | port;
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        x ^= x >> 31;
+        return x;
+    }
+
+    size_t slot_for(uint32_t ip, uint16_t port) const { return hash(ip, port) & mask_; }
+
+    size_t free_slot(uint32_t ip, uint16_t port) const
+    {
+        size_t i = slot_for(ip, port);
+        while (entries_[i].used)
+            i = (i + 1) & mask_;
+        return i;
+    }
+
+    void grow()
+    {
+        std::vector<client_entry> old = std::move(entries_);
+        entries_.assign(std::max(MIN_CAPACITY, old.size() * 2), client_entry{});
+        mask_ = entries_.size() - 1;
+        for (const client_entry& e: old) {
+            if (e.used)
+                entries_[free_slot(e.ip, e.port)] = e;
+        }
+    }
+
+private:
+    std::vector<client_entry> entries_;
+    size_t mask_ = 0;
+    size_t count_ = 0;
+};
@@ -1,37 +1,22 @@
+#include "client_table.h"
 #include "socket_tools.h"
+#include "timing_wheel.h"
+#include "uring_backend.h"
 #include <netdb.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <algorithm>
 #include <chrono>
 #include <cstdio>
 #include <cstring>
 #include <iostream>
 #include <sstream>
-#include <unordered_map>
+#include <thread>
 #include <vector>
 
 using namespace std::chrono_literals;
 
-namespace std {
-template<>
-struct hash<sockaddr_in> {
-    std::size_t operator()(sockaddr_in const& a) const
-    {
-        return std::hash<decltype(a.sin_addr.s_addr)>()(a.sin_addr.s_addr) ^
-               (std::hash<decltype(a.sin_family)>()(a.sin_family) << 2) ^
-               (std::hash<decltype(a.sin_port)>()(a.sin_port) << 1);
-    }
-};
-} // namespace std
-
-// kms
-bool operator==(sockaddr_in a, sockaddr_in b)
-{
-    return a.sin_port == b.sin_port && a.sin_family == b.sin_family &&
-           a.sin_addr.s_addr == b.sin_addr.s_addr;
-}
-
 std::string format_client(sockaddr_in client)
 {
     auto ip = client.sin_addr.s_addr;
@@ -52,55 +37,100 @@ std::string format_client(sockaddr_in client)
 }
 
 const std::chrono::duration PING_TIME = 500ms;
+const std::chrono::duration PING_RETRY = 100ms;
 const std::chrono::duration TIMEOUT = 5s;
+const std::chrono::duration WHEEL_GRANULARITY = 10ms;
+
+// Datagrams per recvmmsg/sendmmsg call
+constexpr size_t BATCH_SIZE = 64;
+constexpr size_t BUF_SIZE = 1000;
+
+// Everything a worker owns
+struct shard {
+    int sfd;
+    client_table clients;
+    // Exactly one pending timer per known client
+    timing_wheel<sockaddr_in> keepalive{WHEEL_GRANULARITY};
+
+    // Allocated once per worker, reused for every wakeup
+    dgram_batch in{BATCH_SIZE, BUF_SIZE};
+    dgram_batch out{BATCH_SIZE, BUF_SIZE};
+};
 
-void handle_keepalive(
-    std::unordered_map<sockaddr_in, std::chrono::steady_clock::time_point>& last_seen,
-    int ping_sock)
+void flush_replies(shard& s)
 {
-    auto time = std::chrono::steady_clock::now();
-    std::vector<sockaddr_in> dead;
-    for (const auto& client: last_seen) {
-        if (time > client.second + TIMEOUT) {
-            dead.emplace_back(client.first);
-            std::cout << "Client " << format_client(client.first)
-                      << " timed out\n";
-            continue;
-        }
-        if (time > client.second + PING_TIME) {
-            std::string payload = "k";
-            ssize_t res = sendto(
-                ping_sock,
-                payload.c_str(),
-                payload.size(),
-                0,
-                (sockaddr*)&client.first,
-                sizeof(client.first));
-            if (res == -1) {
-                dead.emplace_back(client.first);
-                std::cout << "Unable to ping client "
-                          << format_client(client.first)
-                          << " with err=" << strerror(errno) << std::endl;
-            }
-        }
+    s.out.flush(s.sfd, [](const sockaddr_in& to, int err) {
+        std::cout << "Unable to send to client " << format_client(to)
+                  << " with err=" << strerror(err) << std::endl;
+    });
+}
+
+void queue_reply(shard& s, const sockaddr_in& to, const char* data, size_t len)
+{
+    if (s.out.full())
+        flush_replies(s);
+    s.out.push(to, data, len);
+}
+
+// Datagrams only bump last_seen, the timer notices on fire and moves itself
+void on_keepalive_timer(
+    shard& s, const sockaddr_in& client, std::chrono::steady_clock::time_point time)
+{
+    client_entry* entry = s.clients.find(client);
+    if (!entry)
+        return;
+
+    auto seen = entry->last_seen;
+    if (time > seen + TIMEOUT) {
+        std::cout << "Client " << format_client(client) << " timed out after "
+                  << int(entry->pings) << " pings\n";
+        s.clients.erase(entry);
+        return;
     }
-    for (const auto& ded: dead) {
-        last_seen.erase(ded);
+    if (time < seen + PING_TIME) {
+        s.keepalive.schedule(client, seen + PING_TIME);
+        return;
     }
+
+    if (entry->pings < UINT8_MAX)
+        ++entry->pings;
+    queue_reply(s, client, "k", 1);
+    s.keepalive.schedule(
+        client, std::min(time + PING_RETRY, seen + TIMEOUT + WHEEL_GRANULARITY));
 }
 
-int main(int argc, const char** argv)
+void handle_keepalive(shard& s)
 {
-    std::unordered_map<sockaddr_in, std::chrono::steady_clock::time_point> last_seen;
+    auto time = std::chrono::steady_clock::now();
+    s.keepalive.advance(time, [&s, time](const sockaddr_in& client) {
+        on_keepalive_timer(s, client, time);
+    });
+}
 
-    const char* port = "2024";
+void handle_datagram(shard& s, const sockaddr_in& from, char* buffer, size_t numBytes)
+{
+    auto now = std::chrono::steady_clock::now();
+    auto [entry, inserted] = s.clients.insert(from);
+    if (inserted) {
+        std::cout << "Client " << format_client(from) << " connected\n";
+        s.keepalive.schedule(from, now + PING_TIME);
+    }
+    entry->last_seen = now;
+    entry->pings = 0;
 
-    int sfd = create_dgram_socket(nullptr, port, nullptr);
+    if (numBytes > 0 && buffer[0] == 'm') {
+        std::cout << "Received from client " << format_client(from) << ": "
+                  << buffer + 1 << '\n';
 
-    if (sfd == -1)
-        return 1;
-    printf("listening!\n");
+        char reply[BUF_SIZE];
+        int len = snprintf(reply, sizeof(reply), "%s too", buffer);
+        queue_reply(s, from, reply, std::min<size_t>(len, sizeof(reply) - 1));
+    }
+}
 
+void serve_select(shard& s)
+{
+    int sfd = s.sfd;
     fd_set readSet;
     FD_ZERO(&readSet);
 
@@ -112,35 +142,78 @@ int main(int argc, const char** argv)
         };
         select(sfd + 1, &readSet, nullptr, nullptr, &timeout);
 
-        handle_keepalive(last_seen, sfd);
+        handle_keepalive(s);
 
         if (FD_ISSET(sfd, &readSet)) {
-            constexpr size_t buf_size = 1000;
-            static char buffer[buf_size];
-            memset(buffer, 0, buf_size);
+            // Drain the socket, a batch at a time
+            while (s.in.recv(sfd) > 0) {
+                for (size_t i = 0; i < s.in.size(); ++i) {
+                    handle_datagram(s, s.in.addr(i), s.in.data(i), s.in.len(i));
+                }
+                if (!s.in.full())
+                    break;
+            }
+        }
 
-            sockaddr_in from{};
-            socklen_t from_len = sizeof(from);
+        flush_replies(s);
+    }
+}
 
-            ssize_t numBytes = recvfrom(
-                sfd, buffer, buf_size - 1, 0, (sockaddr*)&from, &from_len);
+enum class backend {
+    select,
+    uring,
+};
 
-            if (last_seen.count(from) == 0)
-                std::cout << "Client " << format_client(from) << " connected\n";
+void serve(int sfd, backend kind)
+{
+    shard s{.sfd = sfd};
+
+    if (kind == backend::uring) {
+        uring_callbacks callbacks{
+            .on_datagram =
+                [&s](const sockaddr_in& from, char* data, size_t len) {
+                    handle_datagram(s, from, data, len);
+                },
+            .on_tick = [&s]() { handle_keepalive(s); },
+            .on_wakeup = [&s]() { flush_replies(s); },
+        };
+        run_uring_loop(sfd, BUF_SIZE, 100ms, callbacks);
+        std::cout << "Falling back to select" << std::endl;
+    }
 
-            last_seen[from] = std::chrono::steady_clock::now();
+    serve_select(s);
+}
 
-            if (numBytes > 0 && buffer[0] == 'm') {
-                std::cout << "Received from client " << format_client(from)
-                          << ": " << buffer + 1 << '\n';
-                auto oldlen = strlen(buffer);
-                snprintf(buffer + oldlen, sizeof(buffer) - oldlen, "%s", " too");
+int main(int argc, const char** argv)
+{
+    const char* port = "2024";
 
-                ssize_t res = sendto(
-                    sfd, buffer, strlen(buffer), 0, (sockaddr*)&from, from_len);
-                if (res == -1)
-                    std::cout << strerror(errno) << std::endl;
-            }
-        }
+    // Every worker gets its own SO_REUSEPORT socket. The kernel picks the
+    // socket by hashing the client's address, so a client always lands on the
+    // same worker and its client entry never has to be shared.
+    int workers = argc > 1 ? std::atoi(argv[1]) : 1;
+    backend kind = backend::select;
+    if (argc > 2 && strcmp(argv[2], "uring") == 0)
+        kind = backend::uring;
+    else if (argc > 2 && strcmp(argv[2], "select") != 0)
+        workers = 0;
+    if (workers < 1) {
+        printf("Usage: %s [worker threads] [select|uring]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<int> sockets;
+    for (int i = 0; i < workers; ++i) {
+        int sfd = create_dgram_socket(nullptr, port, nullptr, workers > 1);
+        if (sfd == -1)
+            return 1;
+        sockets.push_back(sfd);
+    }
+    printf("listening with %d worker(s)!\n", workers);
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < sockets.size(); ++i) {
+        threads.emplace_back(serve, sockets[i], kind);
     }
+    serve(sockets[0], kind);
 }
@@ -10,7 +10,7 @@
 #include "socket_tools.h"
 
 // Adaptation of linux man page: https://linux.die.net/man/3/getaddrinfo
-static int get_dgram_socket(addrinfo *addr, bool should_bind, addrinfo *res_addr)
+static int get_dgram_socket(addrinfo *addr, bool should_bind, bool reuse_port, addrinfo *res_addr)
 {
   for (addrinfo *ptr = addr; ptr != nullptr; ptr = ptr->ai_next)
   {
@@ -24,6 +24,12 @@ static int get_dgram_socket(addrinfo *addr, bool should_bind, addrinfo *res_addr
 
     int trueVal = 1;
     setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &trueVal, sizeof(int));
+    // Several sockets on one port, the kernel spreads clients between them by address hash
+    if (reuse_port && setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &trueVal, sizeof(int)) != 0)
+    {
+      close(sfd);
+      continue;
+    }
 
     if (res_addr)
       *res_addr = *ptr;
@@ -38,7 +44,7 @@ static int get_dgram_socket(addrinfo *addr, bool should_bind, addrinfo *res_addr
   return -1;
 }
 
-int create_dgram_socket(const char *address, const char *port, addrinfo *res_addr)
+int create_dgram_socket(const char *address, const char *port, addrinfo *res_addr, bool reuse_port)
 {
   addrinfo hints {};
 
@@ -53,9 +59,81 @@ int create_dgram_socket(const char *address, const char *port, addrinfo *res_add
   if (getaddrinfo(address, port, &hints, &result) != 0)
     return 1;
 
-  int sfd = get_dgram_socket(result, isListener, res_addr);
+  int sfd = get_dgram_socket(result, isListener, reuse_port, res_addr);
+
+  freeaddrinfo(result);
+  return sfd;
+}
+
+int create_dgram_socket(const char *address, const char *port, sockaddr_storage *res_addr, socklen_t *res_addrlen, bool reuse_port)
+{
+  addrinfo hints {};
+
+  bool isListener = !address;
+
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  if (isListener)
+    hints.ai_flags = AI_PASSIVE;
+
+  addrinfo *result = nullptr;
+  if (getaddrinfo(address, port, &hints, &result) != 0)
+    return -1;
+
+  addrinfo picked {};
+  int sfd = get_dgram_socket(result, isListener, reuse_port, &picked);
+  // picked.ai_addr points into result, copy it out while that is still alive
+  if (sfd != -1 && res_addr)
+  {
+    memcpy(res_addr, picked.ai_addr, picked.ai_addrlen);
+    *res_addrlen = picked.ai_addrlen;
+  }
 
   freeaddrinfo(result);
   return sfd;
 }
 
+
+dgram_batch::dgram_batch(size_t capacity, size_t buf_size)
+  : buf_size(buf_size), buffers(capacity * buf_size), addrs(capacity), iovs(capacity), msgs(capacity)
+{
+}
+
+void dgram_batch::reset_headers(size_t i, size_t len)
+{
+  iovs[i] = {.iov_base = data(i), .iov_len = len};
+  msgs[i] = {};
+  msgs[i].msg_hdr.msg_name = &addrs[i];
+  msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+  msgs[i].msg_hdr.msg_iov = &iovs[i];
+  msgs[i].msg_hdr.msg_iovlen = 1;
+}
+
+int dgram_batch::recv(int sfd)
+{
+  for (size_t i = 0; i < msgs.size(); ++i)
+    reset_headers(i, buf_size - 1);
+
+  int res = recvmmsg(sfd, msgs.data(), msgs.size(), MSG_DONTWAIT, nullptr);
+  count = res > 0 ? res : 0;
+  for (size_t i = 0; i < count; ++i)
+    data(i)[msgs[i].msg_len] = '\0';
+  return res;
+}
+
+bool dgram_batch::push(const sockaddr_in &to, const char *payload, size_t len)
+{
+  if (full() || len > buf_size)
+    return false;
+
+  memcpy(data(count), payload, len);
+  addrs[count] = to;
+  reset_headers(count, len);
+  ++count;
+  return true;
+}
+
+int dgram_batch::send_some(int sfd, size_t from)
+{
+  return sendmmsg(sfd, msgs.data() + from, count - from, 0);
+}
@@ -1,5 +1,76 @@
 #pragma once
 
+#include <netinet/in.h>
+#include <cerrno>
+#include <sys/socket.h>
+#include <cstddef>
+#include <vector>
+
 struct addrinfo;
 
-int create_dgram_socket(const char *address, const char *port, addrinfo *res_addr);
+// reuse_port sets SO_REUSEPORT, so that several listeners can share the port
+int create_dgram_socket(const char *address, const char *port, addrinfo *res_addr, bool reuse_port = false);
+
+// Same, but copies the resolved address out: res_addr->ai_addr above points
+// into the freed getaddrinfo list and must not be used for sending
+int create_dgram_socket(const char *address, const char *port, sockaddr_storage *res_addr, socklen_t *res_addrlen, bool reuse_port = false);
+
+// Preallocated message vectors for recvmmsg/sendmmsg, so that a whole batch
+// of datagrams costs a single syscall.
+class dgram_batch
+{
+public:
+  dgram_batch(size_t capacity, size_t buf_size);
+
+  dgram_batch(const dgram_batch &) = delete;
+  dgram_batch &operator=(const dgram_batch &) = delete;
+
+  // Replaces the contents with whatever is queued on the socket, without blocking.
+  // Datagrams are null-terminated for convenience. Returns the count or -1.
+  int recv(int sfd);
+
+  // Queues a datagram to be sent by the next flush,
+  // returns false when the batch is full and has to be flushed first
+  // (or when the datagram is longer than buf_size)
+  bool push(const sockaddr_in &to, const char *data, size_t len);
+
+  // Sends everything queued and empties the batch. Datagrams the kernel refuses
+  // are reported to on_error(address, errno) and dropped.
+  template <class F>
+  void flush(int sfd, F on_error)
+  {
+    size_t sent = 0;
+    while (sent < count)
+    {
+      int res = send_some(sfd, sent);
+      if (res < 0)
+      {
+        on_error(addrs[sent], errno);
+        ++sent;
+        continue;
+      }
+      sent += res;
+    }
+    count = 0;
+  }
+
+  size_t size() const { return count; }
+  bool full() const { return count == msgs.size(); }
+  bool empty() const { return count == 0; }
+
+  char *data(size_t i) { return buffers.data() + i * buf_size; }
+  size_t len(size_t i) const { return msgs[i].msg_len; }
+  const sockaddr_in &addr(size_t i) const { return addrs[i]; }
+
+private:
+  int send_some(int sfd, size_t from);
+  void reset_headers(size_t i, size_t len);
+
+private:
+  size_t buf_size;
+  size_t count = 0;
+  std::vector<char> buffers;
+  std::vector<sockaddr_in> addrs;
+  std::vector<iovec> iovs;
+  std::vector<mmsghdr> msgs;
+};
@@ -0,0 +1,121 @@
+#include "client_table.h"
+#include <arpa/inet.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+// Compares client_table against the unordered_map + xor hash it replaced,
+// on clients that look like they come from behind a handful of NATs.
+
+struct xor_hash {
+    size_t operator()(const sockaddr_in& a) const
+    {
+        return std::hash<decltype(a.sin_addr.s_addr)>()(a.sin_addr.s_addr) ^
+               (std::hash<decltype(a.sin_family)>()(a.sin_family) << 2) ^
+               (std::hash<decltype(a.sin_port)>()(a.sin_port) << 1);
+    }
+};
+
+struct addr_equal {
+    bool operator()(const sockaddr_in& a, const sockaddr_in& b) const
+    {
+        return a.sin_port == b.sin_port && a.sin_family == b.sin_family &&
+               a.sin_addr.s_addr == b.sin_addr.s_addr;
+    }
+};
+
+using legacy_map =
+    std::unordered_map<sockaddr_in, std::chrono::steady_clock::time_point, xor_hash, addr_equal>;
+
+std::vector<sockaddr_in> make_clients(size_t count, uint32_t first_ip)
+{
+    std::vector<sockaddr_in> res;
+    res.reserve(count);
+    // 64k ports per address, like a carrier grade NAT handing them out
+    for (size_t i = 0; i < count; ++i) {
+        sockaddr_in a{};
+        a.sin_family = AF_INET;
+        a.sin_addr.s_addr = htonl(first_ip + uint32_t(i >> 16));
+        a.sin_port = htons(uint16_t(i));
+        res.push_back(a);
+    }
+    return res;
+}
+
+template<class F>
+double measure(const char* name, size_t ops, F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double, std::nano> took = std::chrono::steady_clock::now() - start;
+    double per_op = took.count() / ops;
+    printf("  %-16s %8.1f ns/op\n", name, per_op);
+    return per_op;
+}
+
+int main(int argc, const char** argv)
+{
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    if (count == 0) {
+        printf("Usage: %s [clients]\n", argv[0]);
+        return 1;
+    }
+
+    auto clients = make_clients(count, 0x0a000000); // 10.0.0.0
+    auto strangers = make_clients(count, 0x0b000000); // 11.0.0.0
+
+    // Lookups in random order, as datagrams would arrive
+    std::vector<sockaddr_in> lookups = clients;
+    std::shuffle(lookups.begin(), lookups.end(), std::mt19937{42});
+
+    auto now = std::chrono::steady_clock::now();
+    size_t found = 0;
+
+    printf("client_table, %zu clients\n", count);
+    client_table table;
+    measure("insert", count, [&] {
+        for (auto& a: clients)
+            table.insert(a).first->last_seen = now;
+    });
+    measure("lookup hit", count, [&] {
+        for (auto& a: lookups)
+            found += table.find(a) != nullptr;
+    });
+    measure("lookup miss", count, [&] {
+        for (auto& a: strangers)
+            found += table.find(a) != nullptr;
+    });
+    measure("erase", count, [&] {
+        for (auto& a: lookups)
+            table.erase(a);
+    });
+
+    printf("unordered_map + xor hash, %zu clients\n", count);
+    legacy_map map;
+    measure("insert", count, [&] {
+        for (auto& a: clients)
+            map.try_emplace(a, now);
+    });
+    measure("lookup hit", count, [&] {
+        for (auto& a: lookups)
+            found += map.find(a) != map.end();
+    });
+    measure("lookup miss", count, [&] {
+        for (auto& a: strangers)
+            found += map.find(a) != map.end();
+    });
+    measure("erase", count, [&] {
+        for (auto& a: lookups)
+            map.erase(a);
+    });
+
+    // Keeps the lookups from being optimized out, and doubles as a sanity check
+    if (found != 2 * count || table.size() != 0 || !map.empty()) {
+        printf("mismatch: found %zu, %zu left in table, %zu in map\n", found, table.size(), map.size());
+        return 1;
+    }
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Hierarchical timing wheel: LEVELS wheels of SLOTS buckets each, every level
+// SLOTS times coarser than the previous one. Scheduling is O(1), and advancing
+// only touches the buckets of the ticks that passed plus an occasional cascade,
+// so timers that are not due cost nothing.
+//
+// There is no cancellation: owners are expected to check on fire whether the
+// timer is still relevant and reschedule it if not.
+template<class T, class Clock = std::chrono::steady_clock>
+class timing_wheel {
+    static constexpr unsigned BITS = 6;
+    static constexpr uint64_t SLOTS = 1 << BITS;
+    static constexpr uint64_t MASK = SLOTS - 1;
+    static constexpr unsigned LEVELS = 4;
+
+public:
+    timing_wheel(typename Clock::duration granularity, typename Clock::time_point start = Clock::now())
+        : granularity_(granularity), start_(start)
+    {
+    }
+
+    // Fires at the first advance() at or after deadline (rounded up to the granularity)
+    void schedule(T value, typename Clock::time_point deadline)
+    {
+        insert({to_tick(deadline), std::move(value)});
+        ++size_;
+    }
+
+    // Calls f(value) for every timer that is due by now.
+    // f may schedule new timers, including for the value it was given.
+    template<class F>
+    void advance(typename Clock::time_point now, F f)
+    {
+        const uint64_t target = to_tick(now);
+        while (next_ <= target) {
+            const uint64_t tick = next_;
+
+            // Lower wheel wrapped around, bring the next bucket of each coarser one down
+            for (unsigned level = 1; level < LEVELS; ++level) {
+                if ((tick & ((uint64_t{1} << (BITS * level)) - 1)) != 0)
+                    break;
+                cascade(level, (tick >> (BITS * level)) & MASK);
+            }
+
+            fired_.clear();
+            std::swap(fired_, wheels_[0][tick & MASK]);
+            next_ = tick + 1;
+            size_ -= fired_.size();
+            for (auto& entry: fired_) {
+                f(std::move(entry.value));
+            }
+        }
+    }
+
+    size_t size() const { return size_; }
+
+private:
+    struct entry {
+        uint64_t tick;
+        T value;
+    };
+
+    uint64_t to_tick(typename Clock::time_point time) const
+    {
+        if (time <= start_)
+            return 0;
+        // Round up, so that nothing fires early
+        return (time - start_ + granularity_ - typename Clock::duration{1}) / granularity_;
+    }
+
+    void insert(entry e)
+    {
+        if (e.tick < next_)
+            e.tick = next_;
+
+        uint64_t delta = e.tick - next_;
+        for (unsigned level = 0; level < LEVELS; ++level) {
+            if (delta < (uint64_t{1} << (BITS * (level + 1)))) {
+                wheels_[level][(e.tick >> (BITS * level)) & MASK].push_back(std::move(e));
+                return;
+            }
+        }
+
+        // Further away than the wheel reaches (days at 10ms granularity),
+        // clamp it to the horizon. Owners re-check on fire anyway.
+        e.tick = next_ + (uint64_t{1} << (BITS * LEVELS)) - 1;
+        insert(std::move(e));
+    }
+
+    void cascade(unsigned level, uint64_t index)
+    {
+        cascaded_.clear();
+        std::swap(cascaded_, wheels_[level][index]);
+        for (auto& e: cascaded_) {
+            insert(std::move(e));
+        }
+    }
+
+private:
+    typename Clock::duration granularity_;
+    typename Clock::time_point start_;
+
+    // Next tick to be processed
+    uint64_t next_ = 0;
+    size_t size_ = 0;
+
+    std::array<std::array<std::vector<entry>, SLOTS>, LEVELS> wheels_;
+    // Kept around so their capacity is reused
+    std::vector<entry> fired_;
+    std::vector<entry> cascaded_;
+};
@@ -0,0 +1,351 @@
+#include "uring_backend.h"
+
+#if __has_include(<linux/io_uring.h>)
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+// No liburing in the build, so the ring is driven by hand
+class uring {
+public:
+    ~uring()
+    {
+        if (sqes)
+            munmap(sqes, sqes_len);
+        if (cq_ptr && cq_ptr != sq_ptr)
+            munmap(cq_ptr, cq_len);
+        if (sq_ptr)
+            munmap(sq_ptr, sq_len);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool init(unsigned entries)
+    {
+        io_uring_params p{};
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+        if (fd < 0)
+            return false;
+
+        sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap)
+            sq_len = cq_len = std::max(sq_len, cq_len);
+
+        sq_ptr = map(sq_len, IORING_OFF_SQ_RING);
+        if (!sq_ptr)
+            return false;
+        cq_ptr = single_mmap ? sq_ptr : map(cq_len, IORING_OFF_CQ_RING);
+        if (!cq_ptr)
+            return false;
+        sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(map(sqes_len, IORING_OFF_SQES));
+        if (!sqes)
+            return false;
+
+        auto sq = static_cast<char*>(sq_ptr);
+        sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_entries = p.sq_entries;
+        sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+
+        auto cq = static_cast<char*>(cq_ptr);
+        cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    io_uring_sqe* get_sqe()
+    {
+        unsigned tail = *sq_tail;
+        if (tail - load_acquire(sq_head) == sq_entries && enter(0) < 0)
+            return nullptr;
+
+        unsigned index = tail & sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sq_array[index] = index;
+        store_release(sq_tail, tail + 1);
+        ++to_submit;
+        return sqe;
+    }
+
+    // Submits whatever is queued and waits for at least min_complete completions
+    int enter(unsigned min_complete)
+    {
+        int res;
+        do {
+            res = static_cast<int>(syscall(
+                __NR_io_uring_enter,
+                fd,
+                to_submit,
+                min_complete,
+                min_complete > 0 ? IORING_ENTER_GETEVENTS : 0,
+                nullptr,
+                0));
+        } while (res < 0 && errno == EINTR);
+        if (res >= 0)
+            to_submit -= std::min<unsigned>(res, to_submit);
+        return res;
+    }
+
+    template<class F>
+    void for_each_cqe(F f)
+    {
+        unsigned head = *cq_head;
+        unsigned tail = load_acquire(cq_tail);
+        for (; head != tail; ++head) {
+            f(cqes[head & cq_mask]);
+        }
+        store_release(cq_head, head);
+    }
+
+    int register_buffer_ring(void* ring, unsigned entries, uint16_t group)
+    {
+        io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+        reg.ring_entries = entries;
+        reg.bgid = group;
+        return static_cast<int>(
+            syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1));
+    }
+
+private:
+    void* map(size_t len, off_t offset)
+    {
+        void* ptr = mmap(
+            nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+
+    static unsigned load_acquire(unsigned* p)
+    {
+        return std::atomic_ref<unsigned>(*p).load(std::memory_order_acquire);
+    }
+
+    static void store_release(unsigned* p, unsigned value)
+    {
+        std::atomic_ref<unsigned>(*p).store(value, std::memory_order_release);
+    }
+
+private:
+    int fd = -1;
+    unsigned to_submit = 0;
+
+    void* sq_ptr = nullptr;
+    size_t sq_len = 0;
+    void* cq_ptr = nullptr;
+    size_t cq_len = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqes_len = 0;
+
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned* sq_array = nullptr;
+
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+};
+
+// Buffers the kernel picks from for every received datagram; we hand them
+// back once the datagram is processed.
+class buffer_ring {
+public:
+    static constexpr uint16_t GROUP = 0;
+
+    ~buffer_ring()
+    {
+        if (ring)
+            munmap(ring, ring_len);
+    }
+
+    bool init(uring& r, unsigned entries, size_t buf_size)
+    {
+        this->entries = entries;
+        this->buf_size = buf_size;
+        ring_len = entries * sizeof(io_uring_buf);
+        void* mem = mmap(
+            nullptr, ring_len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (mem == MAP_FAILED)
+            return false;
+        ring = static_cast<io_uring_buf_ring*>(mem);
+        buffers.resize(entries * buf_size);
+
+        if (r.register_buffer_ring(ring, entries, GROUP) < 0)
+            return false;
+
+        for (unsigned i = 0; i < entries; ++i)
+            put(i);
+        return true;
+    }
+
+    char* get(unsigned id) { return buffers.data() + id * buf_size; }
+
+    void put(unsigned id)
+    {
+        // Not ring->bufs: in C++ the header's flex array macro adds an empty
+        // struct in front of it, which shifts it away from where the kernel looks
+        auto* bufs = reinterpret_cast<io_uring_buf*>(ring);
+        unsigned tail = ring->tail;
+        io_uring_buf& buf = bufs[tail & (entries - 1)];
+        buf.addr = reinterpret_cast<uint64_t>(get(id));
+        buf.len = static_cast<uint32_t>(buf_size);
+        buf.bid = static_cast<uint16_t>(id);
+        std::atomic_ref<uint16_t>(ring->tail).store(tail + 1, std::memory_order_release);
+    }
+
+private:
+    io_uring_buf_ring* ring = nullptr;
+    size_t ring_len = 0;
+    unsigned entries = 0;
+    size_t buf_size = 0;
+    std::vector<char> buffers;
+};
+
+enum : uint64_t {
+    OP_RECV = 1,
+    OP_TIMEOUT = 2,
+};
+
+constexpr unsigned RING_ENTRIES = 256;
+// Power of two, as the kernel wants
+constexpr unsigned BUFFERS = 1024;
+
+} // namespace
+
+bool run_uring_loop(
+    int sfd,
+    size_t buf_size,
+    std::chrono::milliseconds tick,
+    const uring_callbacks& callbacks)
+{
+    uring ring;
+    if (!ring.init(RING_ENTRIES)) {
+        std::cout << "io_uring unavailable: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Multishot recvmsg puts its header and the source address in front of the payload
+    const size_t header = sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in);
+    buffer_ring buffers;
+    if (!buffers.init(ring, BUFFERS, header + buf_size)) {
+        std::cout << "io_uring buffer rings unavailable: " << strerror(errno)
+                  << std::endl;
+        return false;
+    }
+
+    // Only namelen is looked at by the kernel for multishot, the rest comes from the buffer
+    msghdr recv_template{};
+    recv_template.msg_namelen = sizeof(sockaddr_in);
+
+    auto arm_recv = [&]() {
+        io_uring_sqe* sqe = ring.get_sqe();
+        if (sqe == nullptr) {
+            std::cout << "io_uring submission queue stuck: " << strerror(errno)
+                      << std::endl;
+            return false;
+        }
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = sfd;
+        sqe->addr = reinterpret_cast<uint64_t>(&recv_template);
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = buffer_ring::GROUP;
+        sqe->user_data = OP_RECV;
+        return true;
+    };
+
+    __kernel_timespec tick_ts{
+        .tv_sec = tick.count() / 1000,
+        .tv_nsec = (tick.count() % 1000) * 1000000,
+    };
+    auto arm_timeout = [&]() {
+        io_uring_sqe* sqe = ring.get_sqe();
+        if (sqe == nullptr) {
+            std::cout << "io_uring submission queue stuck: " << strerror(errno)
+                      << std::endl;
+            return false;
+        }
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<uint64_t>(&tick_ts);
+        sqe->len = 1;
+        sqe->user_data = OP_TIMEOUT;
+        return true;
+    };
+
+    if (!arm_recv() || !arm_timeout())
+        return false;
+
+    bool failed = false;
+    while (!failed) {
+        if (ring.enter(1) < 0) {
+            std::cout << "io_uring_enter failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+
+        ring.for_each_cqe([&](const io_uring_cqe& cqe) {
+            if (cqe.user_data == OP_TIMEOUT) {
+                callbacks.on_tick();
+                failed = failed || !arm_timeout();
+                return;
+            }
+
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                unsigned id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+                char* buf = buffers.get(id);
+                auto* out = reinterpret_cast<io_uring_recvmsg_out*>(buf);
+                if (cqe.res >= 0 && out->namelen >= sizeof(sockaddr_in)) {
+                    sockaddr_in from;
+                    memcpy(&from, buf + sizeof(*out), sizeof(from));
+                    char* payload = buf + sizeof(*out) + out->namelen + out->controllen;
+                    size_t len = std::min<size_t>(out->payloadlen, buf_size - 1);
+                    payload[len] = '\0';
+                    callbacks.on_datagram(from, payload, len);
+                }
+                buffers.put(id);
+            }
+
+            // Multishot stops on errors or when it ran out of buffers
+            if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                if (cqe.res < 0 && cqe.res != -ENOBUFS) {
+                    std::cout << "io_uring recvmsg failed: " << strerror(-cqe.res)
+                              << std::endl;
+                    failed = true;
+                    return;
+                }
+                failed = failed || !arm_recv();
+            }
+        });
+
+        callbacks.on_wakeup();
+    }
+    return false;
+}
+
+#else
+
+bool run_uring_loop(int, size_t, std::chrono::milliseconds, const uring_callbacks&)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+
+// Alternative event loop for a datagram socket built on io_uring: one multishot
+// recvmsg feeding from a ring of provided buffers, plus a timeout that is
+// re-armed every tick. Needs Linux 6.0+; run_uring_loop returns false right
+// away if the kernel (or the build) can't do it, so the caller can fall back
+// to select.
+struct uring_callbacks {
+    // data is null-terminated and lives until the callback returns
+    std::function<void(const sockaddr_in& from, char* data, size_t len)> on_datagram;
+    std::function<void()> on_tick;
+    // After every batch of completions, a good place to flush replies
+    std::function<void()> on_wakeup;
+};
+
+bool run_uring_loop(
+    int sfd,
+    size_t buf_size,
+    std::chrono::milliseconds tick,
+    const uring_callbacks& callbacks);
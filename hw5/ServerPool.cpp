@@ -0,0 +1,159 @@
+#include "ServerPool.hpp"
+
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#ifdef __unix__
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char** environ;
+#endif
+
+ServerPool::ServerPool(Config config) : config_{std::move(config)}
+{
+#ifndef __unix__
+    if (enabled()) {
+        spdlog::warn("Server pool is not supported on this platform, start servers by hand");
+        config_.minIdle = 0;
+    }
+#endif
+}
+
+ServerPool::~ServerPool()
+{
+#ifdef __unix__
+    for (auto& child: children_) {
+        kill(static_cast<pid_t>(child.pid), SIGTERM);
+    }
+    for (auto& child: children_) {
+        waitpid(static_cast<pid_t>(child.pid), nullptr, 0);
+    }
+#endif
+}
+
+void ServerPool::update(size_t idleServers)
+{
+    if (!enabled())
+        return;
+
+    reap();
+
+    // Starting servers will have a free room too once they are up
+    auto starting = static_cast<size_t>(std::ranges::count_if(
+        children_, [](const Child& child) { return !child.registered; }));
+    while (idleServers + starting < config_.minIdle &&
+           children_.size() < config_.maxServers) {
+        if (!spawn())
+            break;
+        ++starting;
+    }
+}
+
+void ServerPool::registered(uint16_t port)
+{
+    auto it = std::ranges::find(children_, port, &Child::port);
+    if (it != children_.end() && !it->registered) {
+        it->registered = true;
+        portFailures_.erase(port);
+        spdlog::info(
+            "Pooled server {} on port {} is up in {}ms",
+            it->pid,
+            port,
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                Clock::now() - it->spawnedAt)
+                .count());
+    }
+}
+
+bool ServerPool::spawn()
+{
+#ifdef __unix__
+    // Lowest port no child of ours is using and that is not backing off. Twice
+    // as many ports as servers, so a few taken ones do not stall the pool.
+    auto now = Clock::now();
+    auto usable = [this, now](uint32_t port) {
+        if (port > UINT16_MAX)
+            return false;
+        if (std::ranges::find(children_, port, &Child::port) != children_.end())
+            return false;
+        auto failures = portFailures_.find(static_cast<uint16_t>(port));
+        return failures == portFailures_.end() || now >= failures->second.retryAt;
+    };
+    uint32_t port = config_.firstPort;
+    uint32_t lastPort = port + 2 * config_.maxServers;
+    while (port < lastPort && !usable(port)) {
+        ++port;
+    }
+    if (port >= lastPort || port > UINT16_MAX)
+        return false;
+
+    auto portArg = std::to_string(port);
+    auto lobbyPortArg = std::to_string(config_.lobbyPort);
+    std::string lobbyHost = "127.0.0.1";
+    char* args[] = {
+        config_.serverPath.data(),
+        portArg.data(),
+        lobbyHost.data(),
+        lobbyPortArg.data(),
+        nullptr,
+    };
+
+    pid_t pid;
+    if (int error = posix_spawn(&pid, args[0], nullptr, nullptr, args, environ);
+        error != 0) {
+        spdlog::error("Unable to spawn {}: {}", config_.serverPath, std::strerror(error));
+        return false;
+    }
+
+    spdlog::info("Spawned pooled server {} on port {}", pid, port);
+    children_.push_back(
+        {.pid = pid, .port = static_cast<uint16_t>(port), .spawnedAt = now});
+    return true;
+#else
+    return false;
+#endif
+}
+
+void ServerPool::reap()
+{
+#ifdef __unix__
+    auto now = Clock::now();
+    std::erase_if(children_, [this, now](const Child& child) {
+        auto pid = static_cast<pid_t>(child.pid);
+        if (!child.registered && now - child.spawnedAt > kStartupTimeout) {
+            spdlog::warn("Pooled server {} never registered, killing it", child.pid);
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+            startFailed(child, now);
+            return true;
+        }
+
+        int status = 0;
+        if (waitpid(pid, &status, WNOHANG) != pid)
+            return false;
+        spdlog::warn("Pooled server {} on port {} exited ({})", child.pid, child.port, status);
+        if (!child.registered) {
+            startFailed(child, now);
+        }
+        return true;
+    });
+#endif
+}
+
+void ServerPool::startFailed(const Child& child, Clock::time_point now)
+{
+    auto& failures = portFailures_[child.port];
+    auto backoff = std::min<Clock::duration>(
+        kPortBackoff * (1u << std::min(failures.count, 16u)), kMaxPortBackoff);
+    ++failures.count;
+    failures.retryAt = now + backoff;
+    spdlog::warn(
+        "Port {} failed {} time(s) in a row, skipping it for {}s",
+        child.port,
+        failures.count,
+        std::chrono::duration_cast<std::chrono::seconds>(backoff).count());
+}
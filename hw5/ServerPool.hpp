@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Local hw5_server processes started by the lobby, so that a match never has
+// to wait for someone to start a server by hand. The pool only decides when to
+// spawn; the servers register and heartbeat like any other, and the lobby
+// tells the pool how many of them can take a match right now.
+//
+// Spawning needs posix_spawn, elsewhere the pool stays empty.
+class ServerPool {
+    using Clock = std::chrono::steady_clock;
+
+public:
+    struct Config {
+        std::string serverPath;
+        // Servers with a free room to keep around, 0 disables the pool
+        size_t minIdle = 0;
+        size_t maxServers = 16;
+        // Servers listen on consecutive ports starting here
+        uint16_t firstPort = 0;
+        uint16_t lobbyPort = 0;
+    };
+
+    explicit ServerPool(Config config);
+    ~ServerPool();
+
+    ServerPool(const ServerPool&) = delete;
+    ServerPool& operator=(const ServerPool&) = delete;
+
+    bool enabled() const { return config_.minIdle > 0; }
+
+    // idleServers: registered servers that have a free room
+    void update(size_t idleServers);
+    // A server registered from this port, if it is ours it is no longer starting
+    void registered(uint16_t port);
+
+private:
+    // A server that did not register in this time is considered stuck
+    static constexpr auto kStartupTimeout = std::chrono::seconds{10};
+    // A port whose server died before registering (taken by someone else,
+    // most likely) is left alone for a while, doubling with each failure
+    static constexpr auto kPortBackoff = std::chrono::seconds{1};
+    static constexpr auto kMaxPortBackoff = std::chrono::seconds{60};
+
+    struct Child {
+        long pid;
+        uint16_t port;
+        Clock::time_point spawnedAt;
+        bool registered{false};
+    };
+
+    struct PortFailures {
+        unsigned count{0};
+        Clock::time_point retryAt;
+    };
+
+    bool spawn();
+    void reap();
+    void startFailed(const Child& child, Clock::time_point now);
+
+private:
+    Config config_;
+    std::vector<Child> children_;
+    // Cleared once a server on the port registers
+    std::unordered_map<uint16_t, PortFailures> portFailures_;
+};
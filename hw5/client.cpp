@@ -4,18 +4,32 @@
 #include <optional>
 #include <unordered_set>
 
-#include "common/Allegro.hpp"
 #include "common/AsyncInput.hpp"
+#include "common/Log.hpp"
+#include "common/Metrics.hpp"
+#include "common/RingBuffer.hpp"
 #include "common/Service.hpp"
 #include "common/assert.hpp"
 #include "common/common.hpp"
 #include "common/delta.hpp"
+#include "common/profile.hpp"
 #include "common/proto.hpp"
 
 #include "game/Entity.hpp"
+#include "game/Interpolation.hpp"
 #include "game/gameProto.hpp"
 
-using namespace std::chrono_literals;
+#ifdef NG_HEADLESS
+#include "common/NullRenderer.hpp"
+
+template<class Derived>
+using Renderer = NullRenderer<Derived>;
+#else
+#include "common/Allegro.hpp"
+#include "common/PrimBatch.hpp"
+
+template<class Derived>
+using Renderer = Allegro<Derived>;
 
 ALLEGRO_COLOR colorToAllegro(uint32_t color)
 {
@@ -25,11 +39,14 @@ ALLEGRO_COLOR colorToAllegro(uint32_t color)
         (color >> 16) & 0xff,
         (color >> 24) & 0xff);
 }
+#endif
+
+using namespace std::chrono_literals;
 
 class ClientService :
     public Service<ClientService>,
     public AsyncInput<ClientService>,
-    public Allegro<ClientService> {
+    public Renderer<ClientService> {
     using Clock = std::chrono::steady_clock;
 
     struct StateSnapshot {
@@ -37,25 +54,10 @@ class ClientService :
         Clock::time_point time;
     };
 
-    struct PlayerInputSnapshot {
-        glm::vec2 vel;
-        Clock::time_point time;
-    };
-
 public:
     ClientService() : Service(nullptr, 2, 2) { }
 
-    Entity* entityById(id_t id)
-    {
-        auto it = std::find_if(
-            entities_.begin(), entities_.end(), [id](const Entity& e) {
-                return e.id == id;
-            });
-        if (it == entities_.end())
-            return nullptr;
-
-        return &*it;
-    }
+    Entity* entityById(id_t id) { return findById(entities_, id); }
 
     void handlePacket(ENetPeer*, const PChat& packet)
     {
@@ -81,35 +83,84 @@ public:
     void handlePacket(ENetPeer*, const PLobbyStarted& packet)
     {
         disconnect(std::exchange(lobby_peer_, nullptr), []() {});
-        connect(packet.serverAddress, [this](ENetPeer* server) {
+        connect(serverOverride_.value_or(packet.serverAddress), [this](ENetPeer* server) {
             NG_VERIFY(server != nullptr);
             server_peer_ = server;
-            snapshotHistory_.emplace_back(StateSnapshot{.time = Clock::now()});
+            snapshotHistory_.clear();
+            auto& empty = snapshotHistory_.pushBack();
+            empty.entities.clear();
+            empty.time = Clock::now();
         });
     }
 
     void handlePacket(
         ENetPeer* peer, const PStateDelta& packet, std::span<std::uint8_t> cont)
     {
-        auto& newSnapshot =
-            snapshotHistory_.emplace_back(snapshotHistory_.back());
+        // Built in a recycled slot: a copy into a buffer that already has the
+        // capacity, then the delta on top
+        const auto& prevSnapshot = snapshotHistory_.back();
+        auto& newSnapshot = snapshotHistory_.pushBack();
+        newSnapshot.entities.assign(
+            prevSnapshot.entities.begin(), prevSnapshot.entities.end());
         newSnapshot.time = Clock::now();
 
-        std::cout << "Applying delta of size " << cont.size() << " at epoch "
-                  << packet.epoch << std::endl;
+        NG_LOG_DEBUG_EVERY(
+            1s, "Applying delta of size {} at epoch {}", cont.size(), packet.epoch);
 
         delta_apply(newSnapshot.entities, cont, packet.total_bytes);
-        send(peer, 1, {}, PStateDeltaConfirmation{.epoch = packet.epoch});
+        interpolationDelay_.onSnapshot(newSnapshot.time, packet.epoch);
+        post(peer, 1, {}, PStateDeltaConfirmation{.epoch = packet.epoch});
 
-        if (snapshotHistory_.size() > 10) {
-            snapshotHistory_.pop_front();
+        reconcile(newSnapshot.entities, packet.ackedInputTick);
+    }
+
+    // Rolls the player back to the server's state as of the last input it
+    // applied, then replays the inputs it has not seen yet
+    void reconcile(std::span<const Entity> snapshot, tick_t ackedTick)
+    {
+        static auto& predictionError = metrics::histogram("client_prediction_error_um");
+
+        const auto* authoritative = findById(snapshot, playerEntityId_);
+        if (authoritative == nullptr || ackedTick > currentTick_)
+            return;
+
+        Entity predicted = *authoritative;
+        // Anything older is out of the buffer, the server state is all we have
+        if (currentTick_ - ackedTick < InputBuffer::kCapacity) {
+            for (tick_t tick = ackedTick + 1; tick <= currentTick_; ++tick) {
+                if (auto* vel = playerInputs_.find(tick)) {
+                    predicted.vel = *vel;
+                }
+                predicted.simulate(kTickSeconds);
+            }
+        }
+
+        if (playerPredicted_.has_value()) {
+            predictionError.record(static_cast<uint64_t>(
+                glm::length(predicted.pos - playerPredicted_->pos) * 1e6f));
         }
+        playerPredicted_ = predicted;
     }
 
-    // input delta-compression
-    void handlePacket(ENetPeer* peer, const PStateDeltaConfirmation& packet)
+    // One fixed tick of the player's own entity, on the current input
+    void stepPlayer()
     {
-        inputDeltaSendQueue.ReceiveConfirmation(packet.epoch);
+        auto vel = sanitizeInput(playerDesiredSpeed_);
+        playerInputs_.store(++currentTick_, vel);
+        if (playerPredicted_.has_value()) {
+            playerPredicted_->vel = vel;
+            playerPredicted_->simulate(kTickSeconds);
+        }
+
+        PPlayerInput packet{.lastTick = currentTick_, .velocities = {}};
+        for (size_t i = 0; i < PPlayerInput::kInputsPerPacket; ++i) {
+            tick_t tick = currentTick_ - (PPlayerInput::kInputsPerPacket - 1 - i);
+            if (auto* input = playerInputs_.find(tick)) {
+                packet.velocities[2 * i] = input->x;
+                packet.velocities[2 * i + 1] = input->y;
+            }
+        }
+        post(server_peer_, 1, {}, packet);
     }
 
     void handlePacket(ENetPeer* peer, const PSetKey& packet)
@@ -128,6 +179,8 @@ public:
     {
         if (line == "/begin") {
             begin();
+        } else if (line == "/trace") {
+            profile::requestDump();
         } else if (line == "/list") {
             for (auto id: otherIds_) {
                 std::cout << id << " ";
@@ -141,7 +194,7 @@ public:
                 packet.message.data(),
                 line.data(),
                 std::min(packet.message.size() - 1, line.size()));
-            send(server_peer_, 1, {}, packet);
+            post(server_peer_, 1, {}, packet);
         }
     }
 
@@ -158,6 +211,15 @@ public:
         });
     }
 
+    // Connect here instead of wherever the lobby sends us, e.g. to a proxy in front of the server
+    void overrideServer(char* addr, uint16_t port)
+    {
+        ENetAddress address;
+        enet_address_set_host(&address, addr);
+        address.port = port;
+        serverOverride_ = address;
+    }
+
     void close()
     {
         auto cb = [this]() { shouldStop_ = true; };
@@ -170,17 +232,6 @@ public:
         }
     }
 
-    void keyDown(int keycode)
-    {
-        if (keycode == ALLEGRO_KEY_ESCAPE) {
-            close();
-        } else if (keycode == ALLEGRO_KEY_B) {
-            begin();
-        }
-    }
-
-    void keyUp(int) { }
-
     void mouse(int x, int y)
     {
         playerDesiredSpeed_ = {
@@ -195,43 +246,68 @@ public:
         playerDesiredSpeed_ *= std::clamp(len - 30, 0.f, 100.f) / 100.f;
     }
 
+#ifndef NG_HEADLESS
+    void keyDown(int keycode)
+    {
+        if (keycode == ALLEGRO_KEY_ESCAPE) {
+            close();
+        } else if (keycode == ALLEGRO_KEY_B) {
+            begin();
+        }
+    }
+
+    void keyUp(int) { }
+
     void draw()
     {
+        NG_PROFILE_FUNCTION();
+        static auto& drawnEntities = metrics::gauge("client_drawn_entities");
+
         glm::vec2 playerPos{0.5f, 0.5f};
-        for (auto& entity: entities_) {
-            if (entity.id == playerEntityId_) {
-                playerPos = entity.pos;
-                break;
-            }
+        if (auto* player = entityById(playerEntityId_)) {
+            playerPos = player->pos;
         }
 
         float scale = static_cast<float>(kWidth + kHeight) / 2.f;
+        glm::vec2 screen{kWidth, kHeight};
 
-        auto worldToScreen = [playerPos, scale](glm::vec2 v) {
-            glm::vec2 screen{kWidth, kHeight};
+        auto worldToScreen = [playerPos, scale, screen](glm::vec2 v) {
             return screen / 2.f + (v - playerPos) * scale;
         };
 
+        // The part of the world on screen, centered on the player
+        glm::vec2 halfView = screen / 2.f / scale;
+        auto visible = [playerPos, halfView](glm::vec2 lo, glm::vec2 hi) {
+            return hi.x >= playerPos.x - halfView.x && lo.x <= playerPos.x + halfView.x &&
+                hi.y >= playerPos.y - halfView.y && lo.y <= playerPos.y + halfView.y;
+        };
+
         if (server_peer_ != nullptr) {
+            auto gridColor = al_map_rgba(100, 100, 100, 128);
             int bars = 10;
             for (int i = 0; i <= bars; ++i) {
                 float x = static_cast<float>(i) / static_cast<float>(bars);
-                auto a = worldToScreen({0, x});
-                auto b = worldToScreen({1, x});
-                al_draw_line(
-                    a.x, a.y, b.x, b.y, al_map_rgba(100, 100, 100, 128), 2);
-                auto c = worldToScreen({x, 0});
-                auto d = worldToScreen({x, 1});
-                al_draw_line(
-                    c.x, c.y, d.x, d.y, al_map_rgba(100, 100, 100, 128), 2);
+                if (visible({0, x}, {1, x})) {
+                    batch_.line(worldToScreen({0, x}), worldToScreen({1, x}), 2, gridColor);
+                }
+                if (visible({x, 0}, {x, 1})) {
+                    batch_.line(worldToScreen({x, 0}), worldToScreen({x, 1}), 2, gridColor);
+                }
             }
         }
 
+        int64_t drawn = 0;
         for (auto& entity: entities_) {
-            auto p = worldToScreen(entity.pos);
-            al_draw_filled_circle(
-                p.x, p.y, entity.size * scale, colorToAllegro(entity.color));
+            glm::vec2 extent{entity.size, entity.size};
+            if (!visible(entity.pos - extent, entity.pos + extent))
+                continue;
+            batch_.filledCircle(
+                worldToScreen(entity.pos), entity.size * scale, colorToAllegro(entity.color));
+            ++drawn;
         }
+        drawnEntities.set(drawn);
+
+        batch_.flush();
 
         al_draw_text(
             getFont(),
@@ -240,150 +316,92 @@ public:
             0,
             0,
             "ESC = /exit; B = /begin");
+
+        if (server_peer_ != nullptr) {
+            auto status = fmt::format(
+                "delay {}ms, jitter {:.1f}ms, loss {:.1f}%",
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    interpolationDelay_.delay())
+                    .count(),
+                interpolationDelay_.jitterSecs() * 1000.f,
+                interpolationDelay_.lossRate() * 100.f);
+            al_draw_text(getFont(), al_map_rgb(255, 255, 255), 0, 12, 0, status.c_str());
+        }
     }
+#endif
 
     static float durationToSecs(Clock::duration d)
     {
         return std::chrono::duration_cast<std::chrono::duration<float>>(d).count();
     }
 
-    void interpolate(
-        Entity& targetEnt, const Entity& prevEnt, float delta, float timeDistance)
+    void applySnapshots(Clock::time_point now)
     {
-        if (targetEnt.teleport_count != prevEnt.teleport_count) {
-            targetEnt.pos = prevEnt.pos + prevEnt.vel * delta;
-            return;
-        }
-        auto h = delta / timeDistance;
+        NG_PROFILE_FUNCTION();
+        static auto& delayGauge = metrics::gauge("client_interpolation_delay_us");
 
-        targetEnt.pos = targetEnt.pos * h + (1 - h) * prevEnt.pos;
-    }
-
-    void applySnapshots(Clock::time_point now, float delta)
-    {
-        constexpr auto forcedLagMs = 250ms;
-        auto time = now - forcedLagMs;
+        auto delay = interpolationDelay_.update(now, snapshotHistory_.back().time);
+        delayGauge.set(std::chrono::duration_cast<std::chrono::microseconds>(delay).count());
+        auto time = now - delay;
 
         while (snapshotHistory_.size() > 2 && snapshotHistory_[1].time < time) {
-            snapshotHistory_.pop_front();
+            snapshotHistory_.popFront();
         }
+        if (snapshotHistory_.size() < 2)
+            return;
 
-        auto targetSnapshot = snapshotHistory_[1];
+        const auto& targetSnapshot = snapshotHistory_[1];
         const auto& prevSnapshot = snapshotHistory_[0];
 
-        std::unordered_map<id_t, const Entity*> prevEntities;
-        for (const auto& ent: prevSnapshot.entities) {
-            prevEntities.try_emplace(ent.id, &ent);
-        }
-
-        for (auto& entity: targetSnapshot.entities) {
-            if (entity.id != playerEntityId_) {
-                if (prevEntities.contains(entity.id)) {
-                    const auto& prevEnt = *prevEntities.at(entity.id);
-                    interpolate(
-                        entity,
-                        prevEnt,
-                        durationToSecs(time - prevSnapshot.time),
-                        durationToSecs(targetSnapshot.time - prevSnapshot.time));
-                }
-            } else {
-                auto player = entityById(playerEntityId_);
-                if (player != nullptr) {
-                    entity.pos = player->pos;
-                }
-
-                playerVelHistory_.emplace_back(PlayerInputSnapshot{
-                    .vel = playerDesiredSpeed_,
-                    .time = now,
-                });
-                entity.vel = playerDesiredSpeed_;
-                entity.simulate(delta);
-
-                if (playerServerPredicted.has_value()) {
-                    playerServerPredicted->vel = playerDesiredSpeed_;
-                    playerServerPredicted->simulate(delta);
-
-                    glm::vec2 compensation =
-                        (playerServerPredicted->pos - entity.pos) * delta;
-                    if (glm::length(compensation) > entity.size / 100.f) {
-                        entity.pos += compensation;
-                        playerServerPredicted->pos -= compensation;
-                    }
-                }
-
-                const auto& snapshot = snapshotHistory_.back();
-
-                auto it = std::find_if(
-                    snapshot.entities.begin(),
-                    snapshot.entities.end(),
-                    [this](const Entity& e) { return e.id == playerEntityId_; });
-
-                if (it == snapshot.entities.end()) {
-                    continue;
-                }
-
-                // std::chrono is f'n awesome
-                Clock::time_point last =
-                    snapshot.time - server_peer_->roundTripTime / 2 * 1ms;
-                while (!playerVelHistory_.empty() &&
-                       playerVelHistory_.front().time < last) {
-                    playerVelHistory_.pop_front();
-                }
-
-                Entity predicted = entity;
-                predicted.pos = it->pos;
-                for (auto& [vel, time]: playerVelHistory_) {
-                    predicted.vel = vel;
-                    predicted.simulate(durationToSecs(time - last));
-                    last = time;
-                }
-                playerServerPredicted = predicted;
-            }
+        auto sincePrev = durationToSecs(time - prevSnapshot.time);
+        auto between = durationToSecs(targetSnapshot.time - prevSnapshot.time);
+        interpolator_.blend(
+            prevSnapshot.entities,
+            targetSnapshot.entities,
+            between > 0 ? sincePrev / between : 1.f,
+            sincePrev,
+            entities_);
+
+        // Everyone else is shown in the past, the player as predicted
+        auto* player = entityById(playerEntityId_);
+        if (player != nullptr && playerPredicted_.has_value()) {
+            player->pos = playerPredicted_->pos;
+            player->vel = playerPredicted_->vel;
         }
-
-        entities_ = std::move(targetSnapshot.entities);
     }
 
     void run()
     {
-        constexpr auto kSendRate = 60ms;
+        // Past that ticks are dropped rather than run back to back
+        constexpr auto kMaxCatchUp = 250ms;
 
-        auto startTime = Clock::now();
-        auto currentTime = startTime;
-        auto lastSendTime = startTime;
+        auto nextTick = Clock::now();
 
         while (!shouldStop_) {
             auto now = Clock::now();
-            float delta = durationToSecs(now - std::exchange(currentTime, now));
 
             AsyncInput::poll();
-            Allegro::poll();
-            Service::poll();
+            Renderer<ClientService>::poll();
 
-            if (server_peer_ != nullptr) {
-                applySnapshots(now, delta);
+            if (now - nextTick > kMaxCatchUp) {
+                nextTick = now;
             }
+            while (nextTick <= now) {
+                nextTick += kTickInterval;
+                if (server_peer_ != nullptr && playerEntityId_ != kInvalidId) {
+                    stepPlayer();
+                }
+            }
+
+            Service::poll(nextTick);
 
-            if (server_peer_ != nullptr && playerEntityId_ != kInvalidId &&
-                (now - lastSendTime) > kSendRate) {
-                lastSendTime = now;
-
-                const std::span state{
-                    reinterpret_cast<const uint8_t*>(&playerDesiredSpeed_),
-                    sizeof(playerDesiredSpeed_)};
-
-                const auto [epoch, delta] =
-                    inputDeltaSendQueue.GetStateDelta(state);
-                send(
-                    server_peer_,
-                    1,
-                    {},
-                    PStateDelta{.epoch = epoch, .total_bytes = state.size()},
-                    delta);
+            if (server_peer_ != nullptr) {
+                applySnapshots(now);
             }
+            profile::dumpIfRequested("client");
         }
 
-        Allegro::stop();
+        Renderer<ClientService>::stop();
         std::cout << "Press ENTER to exit..." << std::endl;
         AsyncInput::stop();
     }
@@ -395,30 +413,47 @@ private:
     std::unordered_set<uint32_t> otherIds_;
     bool shouldStop_{false};
 
-    id_t playerEntityId_;
+    id_t playerEntityId_{kInvalidId};
+    // What is drawn: snapshots blended by interpolator_, sorted by id
     std::vector<Entity> entities_;
-    std::deque<StateSnapshot> snapshotHistory_;
-
-    DeltaSendQueue inputDeltaSendQueue;
+    SnapshotInterpolator interpolator_;
+    InterpolationDelay interpolationDelay_;
+#ifndef NG_HEADLESS
+    PrimBatch batch_;
+#endif
+    // Oldest first. Snapshots older than the two being blended are dropped
+    RingBuffer<StateSnapshot, 10> snapshotHistory_;
 
     glm::vec2 playerDesiredSpeed_{0, 0};
-    // kostyl: we don't have a predicted pos for the first few frames
-    std::optional<Entity> playerServerPredicted;
-    std::deque<PlayerInputSnapshot> playerVelHistory_;
+    // Rollback prediction, see reconcile. Empty until a snapshot has the player.
+    tick_t currentTick_{0};
+    InputBuffer playerInputs_;
+    std::optional<Entity> playerPredicted_;
+
+    std::optional<ENetAddress> serverOverride_;
 };
 
 int main(int argc, char** argv)
 {
-    if (argc != 3) {
-        spdlog::error("Usage: {} <lobby addr> <lobby port>\n", argv[0]);
+    logging::init();
+
+    if (argc != 3 && argc != 5) {
+        spdlog::error(
+            "Usage: {} <lobby addr> <lobby port> [<server addr> <server port>]\n",
+            argv[0]);
         return -1;
     }
 
     NG_VERIFY(enet_initialize() == 0);
     std::atexit(enet_deinitialize);
 
+    metrics::exportFromEnv("client");
+
     ClientService client;
 
+    if (argc == 5) {
+        client.overrideServer(argv[3], static_cast<enet_uint16>(std::atoi(argv[4])));
+    }
     client.joinLobby(argv[1], static_cast<enet_uint16>(std::atoi(argv[2])));
 
     client.run();
@@ -41,7 +41,9 @@ private:
     {
         while (!stopped_.load(std::memory_order::relaxed)) {
             std::string result;
-            std::getline(std::cin, result);
+            // Closed stdin, e.g. a headless client started in the background
+            if (!std::getline(std::cin, result))
+                break;
 
             std::lock_guard lock{mtx_};
             lines_.emplace_back(std::move(result));
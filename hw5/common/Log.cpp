@@ -0,0 +1,36 @@
+#include "Log.hpp"
+
+#include <spdlog/async.h>
+#include <spdlog/cfg/env.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <cstdlib>
+#include <memory>
+
+namespace logging {
+
+namespace {
+
+// Messages, not bytes. Past that the oldest ones are dropped instead of
+// blocking the caller.
+constexpr size_t kQueueSize = 8192;
+
+} // namespace
+
+void init()
+{
+    spdlog::init_thread_pool(kQueueSize, 1);
+    auto logger = std::make_shared<spdlog::async_logger>(
+        "hw5",
+        std::make_shared<spdlog::sinks::stdout_color_sink_mt>(),
+        spdlog::thread_pool(),
+        spdlog::async_overflow_policy::overrun_oldest);
+    spdlog::set_default_logger(std::move(logger));
+
+    // SPDLOG_LEVEL=debug (or e.g. "warn,hw5=debug") picks the runtime level
+    spdlog::cfg::load_env_levels();
+
+    // Drains the queue, otherwise whatever was logged last before exit is lost
+    std::atexit([]() { spdlog::shutdown(); });
+}
+
+} // namespace logging
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <spdlog/spdlog.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Logging for the tick and frame paths. logging::init() routes the default
+// spdlog logger through a background thread that drops the oldest messages
+// when it falls behind, so a log call only formats and enqueues.
+//
+// The NG_LOG_* macros on top of that:
+//   - are compiled out below NG_LOG_LEVEL (cmake -DHW5_LOG_LEVEL=...),
+//     arguments included;
+//   - skip formatting when the runtime level filters the message out;
+//   - come in _EVERY flavours that let through at most one message per
+//     interval from a given call site, reporting how many were swallowed.
+namespace logging {
+
+// Call once at the start of main
+void init();
+
+// Per call site, lets one message through per interval. Thread safe; under
+// contention a couple of extra messages might get through, which is fine.
+class RateLimiter {
+public:
+    explicit RateLimiter(std::chrono::steady_clock::duration interval)
+        : interval_{interval.count()}
+    {
+    }
+
+    // Returns whether to log, and if so how many messages were dropped since the last one
+    bool allow(uint64_t& suppressed)
+    {
+        auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+        auto next = next_.load(std::memory_order::relaxed);
+        if (now < next || !next_.compare_exchange_strong(next, now + interval_)) {
+            suppressed_.fetch_add(1, std::memory_order::relaxed);
+            return false;
+        }
+        suppressed = suppressed_.exchange(0, std::memory_order::relaxed);
+        return true;
+    }
+
+private:
+    std::chrono::steady_clock::rep interval_;
+    std::atomic<std::chrono::steady_clock::rep> next_{0};
+    std::atomic<uint64_t> suppressed_{0};
+};
+
+} // namespace logging
+
+#define NG_LOG_LEVEL_TRACE 0
+#define NG_LOG_LEVEL_DEBUG 1
+#define NG_LOG_LEVEL_INFO 2
+#define NG_LOG_LEVEL_WARN 3
+#define NG_LOG_LEVEL_ERROR 4
+#define NG_LOG_LEVEL_OFF 5
+
+#ifndef NG_LOG_LEVEL
+#define NG_LOG_LEVEL NG_LOG_LEVEL_DEBUG
+#endif
+
+#define NG_LOG_IMPL(level, ...)                                    \
+    do {                                                           \
+        if (spdlog::should_log(level)) {                           \
+            spdlog::default_logger_raw()->log(level, __VA_ARGS__); \
+        }                                                          \
+    } while (false)
+
+#define NG_LOG_EVERY_IMPL(level, interval, fmtString, ...)                      \
+    do {                                                                        \
+        if (spdlog::should_log(level)) {                                        \
+            static ::logging::RateLimiter ngLimiter{interval};                  \
+            uint64_t ngSuppressed = 0;                                          \
+            if (!ngLimiter.allow(ngSuppressed)) {                               \
+            } else if (ngSuppressed == 0) {                                     \
+                spdlog::default_logger_raw()->log(                              \
+                    level, fmtString, ##__VA_ARGS__);                           \
+            } else {                                                            \
+                spdlog::default_logger_raw()->log(                              \
+                    level,                                                      \
+                    fmtString " ({} similar suppressed)",                       \
+                    ##__VA_ARGS__,                                              \
+                    ngSuppressed);                                              \
+            }                                                                   \
+        }                                                                       \
+    } while (false)
+
+#define NG_LOG_STRIPPED(...) \
+    do {                     \
+    } while (false)
+
+#if NG_LOG_LEVEL <= NG_LOG_LEVEL_TRACE
+#define NG_LOG_TRACE(...) NG_LOG_IMPL(spdlog::level::trace, __VA_ARGS__)
+#define NG_LOG_TRACE_EVERY(interval, ...) \
+    NG_LOG_EVERY_IMPL(spdlog::level::trace, interval, __VA_ARGS__)
+#else
+#define NG_LOG_TRACE(...) NG_LOG_STRIPPED()
+#define NG_LOG_TRACE_EVERY(...) NG_LOG_STRIPPED()
+#endif
+
+#if NG_LOG_LEVEL <= NG_LOG_LEVEL_DEBUG
+#define NG_LOG_DEBUG(...) NG_LOG_IMPL(spdlog::level::debug, __VA_ARGS__)
+#define NG_LOG_DEBUG_EVERY(interval, ...) \
+    NG_LOG_EVERY_IMPL(spdlog::level::debug, interval, __VA_ARGS__)
+#else
+#define NG_LOG_DEBUG(...) NG_LOG_STRIPPED()
+#define NG_LOG_DEBUG_EVERY(...) NG_LOG_STRIPPED()
+#endif
+
+#if NG_LOG_LEVEL <= NG_LOG_LEVEL_INFO
+#define NG_LOG_INFO(...) NG_LOG_IMPL(spdlog::level::info, __VA_ARGS__)
+#define NG_LOG_INFO_EVERY(interval, ...) \
+    NG_LOG_EVERY_IMPL(spdlog::level::info, interval, __VA_ARGS__)
+#else
+#define NG_LOG_INFO(...) NG_LOG_STRIPPED()
+#define NG_LOG_INFO_EVERY(...) NG_LOG_STRIPPED()
+#endif
+
+#if NG_LOG_LEVEL <= NG_LOG_LEVEL_WARN
+#define NG_LOG_WARN(...) NG_LOG_IMPL(spdlog::level::warn, __VA_ARGS__)
+#define NG_LOG_WARN_EVERY(interval, ...) \
+    NG_LOG_EVERY_IMPL(spdlog::level::warn, interval, __VA_ARGS__)
+#else
+#define NG_LOG_WARN(...) NG_LOG_STRIPPED()
+#define NG_LOG_WARN_EVERY(...) NG_LOG_STRIPPED()
+#endif
+
+#if NG_LOG_LEVEL <= NG_LOG_LEVEL_ERROR
+#define NG_LOG_ERROR(...) NG_LOG_IMPL(spdlog::level::err, __VA_ARGS__)
+#define NG_LOG_ERROR_EVERY(interval, ...) \
+    NG_LOG_EVERY_IMPL(spdlog::level::err, interval, __VA_ARGS__)
+#else
+#define NG_LOG_ERROR(...) NG_LOG_STRIPPED()
+#define NG_LOG_ERROR_EVERY(...) NG_LOG_STRIPPED()
+#endif
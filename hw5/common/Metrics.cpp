@@ -0,0 +1,202 @@
+#include "Metrics.hpp"
+
+#include <spdlog/spdlog.h>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <utility>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace metrics {
+
+namespace {
+
+// `name{labels}` -> `name`
+std::string_view baseName(std::string_view name)
+{
+    return name.substr(0, name.find('{'));
+}
+
+// Groups all series of a metric together, whatever their labels are
+std::pair<std::string, std::string> sortKey(const std::string& name)
+{
+    return {std::string{baseName(name)}, name};
+}
+
+// `name{labels}` -> `labels`
+std::string_view labels(std::string_view name)
+{
+    auto open = name.find('{');
+    if (open == std::string_view::npos)
+        return {};
+    return name.substr(open + 1, name.size() - open - 2);
+}
+
+// Histogram series get a suffix on the name, and `le` next to the other labels
+std::string series(std::string_view name, std::string_view suffix, std::string_view extra = {})
+{
+    std::string result{baseName(name)};
+    result += suffix;
+    auto existing = labels(name);
+    if (existing.empty() && extra.empty())
+        return result;
+
+    result += '{';
+    result += existing;
+    if (!existing.empty() && !extra.empty())
+        result += ',';
+    result += extra;
+    result += '}';
+    return result;
+}
+
+} // namespace
+
+Registry& Registry::instance()
+{
+    static Registry registry;
+    return registry;
+}
+
+Registry::~Registry()
+{
+    {
+        std::lock_guard lock{exportMutex_};
+        stopping_ = true;
+    }
+    exportWakeup_.notify_all();
+    if (exporter_.joinable())
+        exporter_.join();
+}
+
+template<class T>
+T& Registry::findOrAdd(std::deque<Named<T>>& list, Index<T>& index, std::string_view name)
+{
+    std::lock_guard lock{mutex_};
+    if (auto it = index.find(name); it != index.end())
+        return *it->second;
+    auto& added = list.emplace_back(std::string{name});
+    index.emplace(added.name, &added.metric);
+    return added.metric;
+}
+
+Counter& Registry::counter(std::string_view name)
+{
+    return findOrAdd(counters_, counterIndex_, name);
+}
+
+Gauge& Registry::gauge(std::string_view name)
+{
+    return findOrAdd(gauges_, gaugeIndex_, name);
+}
+
+Histogram& Registry::histogram(std::string_view name)
+{
+    return findOrAdd(histograms_, histogramIndex_, name);
+}
+
+std::string Registry::render() const
+{
+    // All series of a metric have to end up under one TYPE line
+    std::map<std::pair<std::string, std::string>, std::string> lines;
+    std::map<std::string, std::string_view, std::less<>> types;
+    {
+        std::lock_guard lock{mutex_};
+        for (auto& [name, metric]: counters_) {
+            types.emplace(baseName(name), "counter");
+            lines[sortKey(name)] = fmt::format("{} {}\n", name, metric.value());
+        }
+        for (auto& [name, metric]: gauges_) {
+            types.emplace(baseName(name), "gauge");
+            lines[sortKey(name)] = fmt::format("{} {}\n", name, metric.value());
+        }
+        for (auto& [name, metric]: histograms_) {
+            types.emplace(baseName(name), "histogram");
+            std::string text;
+            uint64_t cumulative = 0;
+            for (size_t i = 0; i < Histogram::kBuckets; ++i) {
+                cumulative += metric.bucket(i);
+                bool last = i + 1 == Histogram::kBuckets;
+                // Empty buckets at the top carry no information
+                if (!last && cumulative == metric.count() && metric.bucket(i) == 0)
+                    continue;
+                auto le = last ? std::string{"+Inf"}
+                               : std::to_string(Histogram::bucketLimit(i) - 1);
+                text += fmt::format(
+                    "{} {}\n",
+                    series(name, "_bucket", fmt::format("le=\"{}\"", le)),
+                    cumulative);
+            }
+            text += fmt::format("{} {}\n", series(name, "_sum"), metric.sum());
+            text += fmt::format("{} {}\n", series(name, "_count"), metric.count());
+            lines[sortKey(name)] = std::move(text);
+        }
+    }
+
+    std::string result;
+    std::string_view lastBase;
+    for (auto& [key, text]: lines) {
+        std::string_view base = key.first;
+        if (base != lastBase) {
+            result += fmt::format("# TYPE {} {}\n", base, types.find(base)->second);
+            lastBase = base;
+        }
+        result += text;
+    }
+    return result;
+}
+
+void Registry::startExport(std::string path, std::chrono::milliseconds interval)
+{
+    std::lock_guard lock{exportMutex_};
+    if (exporter_.joinable()) {
+        spdlog::warn("Metrics are already being exported");
+        return;
+    }
+    exporter_ = std::thread{[this, path = std::move(path), interval]() {
+        exportLoop(path, interval);
+    }};
+}
+
+void Registry::exportLoop(std::string path, std::chrono::milliseconds interval)
+{
+    auto tmpPath = path + ".tmp";
+    while (true) {
+        {
+            std::ofstream out{tmpPath, std::ios::trunc};
+            out << render();
+        }
+        std::error_code error;
+        std::filesystem::rename(tmpPath, path, error);
+        if (error) {
+            spdlog::warn("Unable to export metrics to {}: {}", path, error.message());
+        }
+
+        // One last export on the way out, so the file has the final values
+        std::unique_lock lock{exportMutex_};
+        if (stopping_)
+            return;
+        exportWakeup_.wait_for(lock, interval, [this]() { return stopping_; });
+    }
+}
+
+void exportFromEnv(std::string_view process)
+{
+    const char* dir = std::getenv("HW5_METRICS_DIR");
+    if (dir == nullptr)
+        return;
+
+    auto path = std::filesystem::path{dir} /
+        fmt::format("{}-{}.prom", process, static_cast<long>(getpid()));
+    spdlog::info("Exporting metrics to {}", path.string());
+    Registry::instance().startExport(path.string(), std::chrono::seconds{1});
+}
+
+} // namespace metrics
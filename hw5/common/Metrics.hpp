@@ -0,0 +1,141 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+// Process-wide counters, gauges and histograms. Updates are single relaxed
+// atomics, so any thread can bump them on a hot path. Looking a metric up by
+// name takes a lock, hence call sites look it up once and keep the reference:
+// metrics are never destroyed.
+//
+// Names may carry Prometheus-style labels, e.g. `bytes_sent_total{peer="3"}`,
+// and the registry renders everything in the Prometheus text format.
+namespace metrics {
+
+class Counter {
+public:
+    void add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order::relaxed); }
+    uint64_t value() const { return value_.load(std::memory_order::relaxed); }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+class Gauge {
+public:
+    void set(int64_t value) { value_.store(value, std::memory_order::relaxed); }
+    void add(int64_t n) { value_.fetch_add(n, std::memory_order::relaxed); }
+    int64_t value() const { return value_.load(std::memory_order::relaxed); }
+
+private:
+    std::atomic<int64_t> value_{0};
+};
+
+// Power of two buckets: bucket i holds values below 2^i (and at least 2^(i-1)),
+// which is plenty to tell a 100us tick from a 10ms one
+class Histogram {
+public:
+    static constexpr size_t kBuckets = 40;
+
+    void record(uint64_t value)
+    {
+        size_t bucket = std::min<size_t>(std::bit_width(value), kBuckets - 1);
+        buckets_[bucket].fetch_add(1, std::memory_order::relaxed);
+        sum_.fetch_add(value, std::memory_order::relaxed);
+        count_.fetch_add(1, std::memory_order::relaxed);
+    }
+
+    // Upper bound of a bucket, the last one is unbounded
+    static uint64_t bucketLimit(size_t bucket) { return uint64_t{1} << bucket; }
+
+    uint64_t bucket(size_t i) const
+    {
+        return buckets_[i].load(std::memory_order::relaxed);
+    }
+    uint64_t sum() const { return sum_.load(std::memory_order::relaxed); }
+    uint64_t count() const { return count_.load(std::memory_order::relaxed); }
+
+private:
+    std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> count_{0};
+};
+
+class Registry {
+public:
+    static Registry& instance();
+
+    ~Registry();
+
+    Counter& counter(std::string_view name);
+    Gauge& gauge(std::string_view name);
+    Histogram& histogram(std::string_view name);
+
+    std::string render() const;
+
+    // Rewrites the file with render() every interval from a background thread.
+    // The file is replaced atomically, so readers never see half of it.
+    void startExport(std::string path, std::chrono::milliseconds interval);
+
+private:
+    template<class T>
+    struct Named {
+        std::string name;
+        T metric;
+    };
+
+    // Keys point into the names stored in the deque
+    template<class T>
+    using Index = std::unordered_map<std::string_view, T*>;
+
+    template<class T>
+    T& findOrAdd(std::deque<Named<T>>& list, Index<T>& index, std::string_view name);
+
+    void exportLoop(std::string path, std::chrono::milliseconds interval);
+
+private:
+    mutable std::mutex mutex_;
+    // Deques never move their elements, so handed out references stay valid
+    std::deque<Named<Counter>> counters_;
+    std::deque<Named<Gauge>> gauges_;
+    std::deque<Named<Histogram>> histograms_;
+    // Per peer metrics alone make for thousands of names
+    Index<Counter> counterIndex_;
+    Index<Gauge> gaugeIndex_;
+    Index<Histogram> histogramIndex_;
+
+    std::mutex exportMutex_;
+    std::condition_variable exportWakeup_;
+    bool stopping_{false};
+    std::thread exporter_;
+};
+
+inline Counter& counter(std::string_view name)
+{
+    return Registry::instance().counter(name);
+}
+
+inline Gauge& gauge(std::string_view name)
+{
+    return Registry::instance().gauge(name);
+}
+
+inline Histogram& histogram(std::string_view name)
+{
+    return Registry::instance().histogram(name);
+}
+
+// If HW5_METRICS_DIR is set, exports to <dir>/<process>-<pid>.prom once a second
+void exportFromEnv(std::string_view process);
+
+} // namespace metrics
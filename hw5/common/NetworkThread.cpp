@@ -0,0 +1,109 @@
+#include "NetworkThread.hpp"
+
+NetworkThread::NetworkThread(ENetHost* host)
+    : host_{host}, worker_{[this]() { work(); }}
+{
+}
+
+NetworkThread::~NetworkThread()
+{
+    stopped_.store(true, std::memory_order::relaxed);
+    worker_.join();
+
+    // Whatever was never handed to the game thread still has to be freed
+    Event event;
+    while (events_.tryPop(event)) {
+        if (event.type == ENET_EVENT_TYPE_RECEIVE) {
+            enet_packet_destroy(event.packet);
+        }
+    }
+    for (auto& parked: overflow_) {
+        if (parked.type == ENET_EVENT_TYPE_RECEIVE) {
+            enet_packet_destroy(parked.packet);
+        }
+    }
+}
+
+void NetworkThread::push(const Command& command)
+{
+    while (!commands_.tryPush(command)) {
+        std::this_thread::yield();
+    }
+}
+
+void NetworkThread::emit(const Event& event)
+{
+    // Behind older parked events, or the game thread would see them reordered
+    if (!overflow_.empty() || !events_.tryPush(event)) {
+        overflow_.push_back(event);
+    }
+}
+
+void NetworkThread::flushOverflow()
+{
+    while (!overflow_.empty() && events_.tryPush(overflow_.front())) {
+        overflow_.pop_front();
+    }
+}
+
+bool NetworkThread::isStale(const Command& command) const
+{
+    return command.peer->state == ENET_PEER_STATE_DISCONNECTED ||
+        command.peer->connectID != command.connectID;
+}
+
+void NetworkThread::execute(const Command& command)
+{
+    switch (command.kind) {
+        case Command::Kind::Send:
+            if ((isStale(command) ||
+                 enet_peer_send(command.peer, command.channel, command.packet) < 0) &&
+                command.packet->referenceCount == 0) {
+                enet_packet_destroy(command.packet);
+            }
+            break;
+
+        case Command::Kind::Release:
+            if (--command.packet->referenceCount == 0) {
+                enet_packet_destroy(command.packet);
+            }
+            break;
+
+        case Command::Kind::Connect: {
+            auto* peer = enet_host_connect(host_, &command.address, 2, 0);
+            emit(Event{
+                {.type = ENET_EVENT_TYPE_NONE, .peer = peer},
+                peer != nullptr ? peer->connectID : 0,
+            });
+        } break;
+
+        case Command::Kind::Disconnect:
+            if (!isStale(command)) {
+                enet_peer_disconnect_later(command.peer, 0);
+            }
+            break;
+    }
+}
+
+void NetworkThread::work()
+{
+    // Short, so that commands don't wait long for the socket
+    constexpr enet_uint32 kServiceTimeoutMs = 1;
+
+    while (!stopped_.load(std::memory_order::relaxed)) {
+        flushOverflow();
+
+        Command command;
+        while (commands_.tryPop(command)) {
+            execute(command);
+        }
+
+        ENetEvent event;
+        if (enet_host_service(host_, &event, kServiceTimeoutMs) <= 0)
+            continue;
+
+        do {
+            emit(Event{event, event.peer->connectID});
+        } while (enet_host_check_events(host_, &event) > 0);
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <enet/enet.h>
+#include <atomic>
+#include <deque>
+#include <thread>
+
+#include "SpscQueue.hpp"
+
+// Owns an ENetHost on a separate thread, so acks and receives keep flowing
+// no matter how long the game loop takes. ENet is not thread safe, hence the
+// game thread never touches the host directly while this is running: it
+// pushes commands and pops events, both through lock-free SPSC queues.
+//
+// Reading immutable-ish peer fields (address, roundTripTime) from the game
+// thread is racy but harmless, it's just a slightly stale value.
+class NetworkThread {
+public:
+    struct Command {
+        enum class Kind {
+            Send,
+            // Drops a reference taken on the game thread, see Service::broadcast
+            Release,
+            Connect,
+            Disconnect,
+        };
+
+        Kind kind;
+        ENetPeer* peer{nullptr};
+        // The connection the game thread means, see Event::connectID. The peer
+        // may have disconnected since, and its slot even gone to someone else.
+        enet_uint32 connectID{0};
+        enet_uint8 channel{0};
+        ENetPacket* packet{nullptr};
+        ENetAddress address{};
+    };
+
+    // Events are ENet's own. ENET_EVENT_TYPE_NONE reports the peer allocated
+    // for a Connect command (or nullptr), in the order the commands were pushed.
+    struct Event : ENetEvent {
+        // Of the connection a NONE or CONNECT event is about, read here because
+        // by the time the game thread looks, the slot may be someone else's.
+        // Commands for the peer have to carry it.
+        enet_uint32 connectID{0};
+    };
+
+    explicit NetworkThread(ENetHost* host);
+    ~NetworkThread();
+
+    NetworkThread(const NetworkThread&) = delete;
+    NetworkThread& operator=(const NetworkThread&) = delete;
+
+    // Blocks (yielding) while the queue is full. The network thread never
+    // blocks on the game thread, so this always gets through eventually.
+    void push(const Command& command);
+    bool tryPop(Event& event) { return events_.tryPop(event); }
+
+private:
+    void work();
+    void execute(const Command& command);
+    bool isStale(const Command& command) const;
+    void emit(const Event& event);
+    void flushOverflow();
+
+private:
+    ENetHost* host_;
+
+    SpscQueue<Command, 4096> commands_;
+    SpscQueue<Event, 4096> events_;
+    // Events the game thread had no room for yet, oldest first. Parking them
+    // here instead of waiting keeps commands draining, which is what a game
+    // thread stuck in push is waiting for. Network thread only.
+    std::deque<Event> overflow_;
+
+    std::atomic<bool> stopped_{false};
+    std::thread worker_;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <numbers>
+
+// Stands in for Allegro<Derived> where there is no display: no window, no
+// drawing, no Allegro at all. Derived's draw() is never called.
+//
+// There is no mouse either, so the player is steered around a circle instead,
+// which keeps input, prediction and reconciliation busy under load.
+template<class Derived>
+class NullRenderer {
+    using Clock = std::chrono::steady_clock;
+
+public:
+    static constexpr int kWidth = 1280;
+    static constexpr int kHeight = 720;
+
+    void poll()
+    {
+        constexpr float kPeriodSecs = 4.f;
+        constexpr float kRadius = 80.f;
+
+        float t = std::chrono::duration<float>(Clock::now() - start_).count();
+        float angle = 2.f * std::numbers::pi_v<float> * t / kPeriodSecs;
+        self().mouse(
+            kWidth / 2 + static_cast<int>(kRadius * std::cos(angle)),
+            kHeight / 2 + static_cast<int>(kRadius * std::sin(angle)));
+    }
+
+    void stop() { }
+
+private:
+    Derived& self() { return *static_cast<Derived*>(this); }
+
+private:
+    Clock::time_point start_{Clock::now()};
+};
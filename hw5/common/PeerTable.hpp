@@ -0,0 +1,93 @@
+#pragma once
+
+#include <enet/enet.h>
+#include <spdlog/spdlog.h>
+#include <cstdint>
+#include <limits>
+#include <ranges>
+#include <utility>
+#include <vector>
+
+#include "assert.hpp"
+
+// ENet hands out peers from a fixed array inside the host, and incomingPeerID
+// is exactly the index of the peer in that array. That gives us a small dense
+// key for free, so no need to hash pointers.
+inline size_t peerSlot(const ENetPeer* peer)
+{
+    return peer->incomingPeerID;
+}
+
+// Per-peer data indexed by the peer's slot in its host.
+// Entries are kept contiguous so iterating over active peers is a plain array walk.
+template<class T>
+class PeerTable {
+    static constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
+public:
+    using value_type = std::pair<ENetPeer*, T>;
+
+    T* find(const ENetPeer* peer)
+    {
+        auto slot = peerSlot(peer);
+        if (slot >= slotToIndex_.size() || slotToIndex_[slot] == kNone)
+            return nullptr;
+        return &entries_[slotToIndex_[slot]].second;
+    }
+
+    const T* find(const ENetPeer* peer) const
+    {
+        return const_cast<PeerTable*>(this)->find(peer);
+    }
+
+    bool contains(const ENetPeer* peer) const { return find(peer) != nullptr; }
+
+    T& at(const ENetPeer* peer)
+    {
+        auto* result = find(peer);
+        NG_VERIFY(result != nullptr);
+        return *result;
+    }
+
+    T& emplace(ENetPeer* peer, T value)
+    {
+        auto slot = peerSlot(peer);
+        if (slot >= slotToIndex_.size()) {
+            slotToIndex_.resize(slot + 1, kNone);
+        }
+        NG_ASSERT(slotToIndex_[slot] == kNone);
+
+        slotToIndex_[slot] = static_cast<uint32_t>(entries_.size());
+        return entries_.emplace_back(peer, std::move(value)).second;
+    }
+
+    // Swap-with-last, so iterators and pointers into the table are invalidated
+    bool erase(const ENetPeer* peer)
+    {
+        auto slot = peerSlot(peer);
+        if (slot >= slotToIndex_.size() || slotToIndex_[slot] == kNone)
+            return false;
+
+        auto index = std::exchange(slotToIndex_[slot], kNone);
+        if (index + 1 != entries_.size()) {
+            entries_[index] = std::move(entries_.back());
+            slotToIndex_[peerSlot(entries_[index].first)] = index;
+        }
+        entries_.pop_back();
+        return true;
+    }
+
+    size_t size() const { return entries_.size(); }
+    bool empty() const { return entries_.empty(); }
+
+    auto peers() const { return std::views::keys(entries_); }
+
+    auto begin() { return entries_.begin(); }
+    auto end() { return entries_.end(); }
+    auto begin() const { return entries_.begin(); }
+    auto end() const { return entries_.end(); }
+
+private:
+    std::vector<value_type> entries_;
+    std::vector<uint32_t> slotToIndex_;
+};
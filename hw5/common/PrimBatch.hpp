@@ -0,0 +1,90 @@
+#pragma once
+
+#include <allegro5/allegro5.h>
+#include <allegro5/allegro_primitives.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numbers>
+#include <vector>
+
+// Collects untextured shapes as one triangle list and submits them with a
+// single al_draw_prim, instead of a draw call (and its state setup) per
+// shape. Shapes are drawn in the order they were added. The vertex buffer
+// is reused across frames, so a warmed up batch does not allocate.
+class PrimBatch {
+public:
+    void line(glm::vec2 a, glm::vec2 b, float thickness, ALLEGRO_COLOR color)
+    {
+        glm::vec2 dir = b - a;
+        float len = glm::length(dir);
+        if (len <= 0.f)
+            return;
+        glm::vec2 offset = glm::vec2{-dir.y, dir.x} * (thickness / 2.f / len);
+
+        vertex(a + offset, color);
+        vertex(b + offset, color);
+        vertex(b - offset, color);
+        vertex(a + offset, color);
+        vertex(b - offset, color);
+        vertex(a - offset, color);
+    }
+
+    void filledCircle(glm::vec2 center, float radius, ALLEGRO_COLOR color)
+    {
+        // Segments double with the radius: 8 for small blobs, up to kMaxSegments
+        size_t segments = 8;
+        while (segments < kMaxSegments && static_cast<float>(segments) < radius) {
+            segments *= 2;
+        }
+        size_t stride = kMaxSegments / segments;
+
+        auto& unit = unitCircle();
+        for (size_t i = 0; i < kMaxSegments; i += stride) {
+            vertex(center, color);
+            vertex(center + unit[i] * radius, color);
+            vertex(center + unit[(i + stride) % kMaxSegments] * radius, color);
+        }
+    }
+
+    // Draws everything added since the last flush
+    void flush()
+    {
+        if (!vertices_.empty()) {
+            al_draw_prim(
+                vertices_.data(),
+                nullptr,
+                nullptr,
+                0,
+                static_cast<int>(vertices_.size()),
+                ALLEGRO_PRIM_TRIANGLE_LIST);
+        }
+        vertices_.clear();
+    }
+
+private:
+    static constexpr size_t kMaxSegments = 64;
+
+    static const std::array<glm::vec2, kMaxSegments>& unitCircle()
+    {
+        static const auto points = []() {
+            std::array<glm::vec2, kMaxSegments> result;
+            for (size_t i = 0; i < kMaxSegments; ++i) {
+                float angle = 2.f * std::numbers::pi_v<float> * static_cast<float>(i) /
+                    static_cast<float>(kMaxSegments);
+                result[i] = {std::cos(angle), std::sin(angle)};
+            }
+            return result;
+        }();
+        return points;
+    }
+
+    void vertex(glm::vec2 p, ALLEGRO_COLOR color)
+    {
+        vertices_.push_back(ALLEGRO_VERTEX{
+            .x = p.x, .y = p.y, .z = 0.f, .u = 0.f, .v = 0.f, .color = color});
+    }
+
+    std::vector<ALLEGRO_VERTEX> vertices_;
+};
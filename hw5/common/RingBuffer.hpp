@@ -0,0 +1,65 @@
+#pragma once
+
+#include <spdlog/spdlog.h>
+#include <array>
+#include <cstddef>
+
+#include "assert.hpp"
+
+// Fixed-capacity FIFO over preallocated slots. Slots are recycled, never
+// destroyed: pushBack hands out the slot after the last one (dropping the
+// oldest element if full) with whatever it held before, so vectors inside
+// keep their capacity and a warmed up ring does not allocate.
+template<class T, size_t N>
+class RingBuffer {
+    static_assert(N > 0);
+
+public:
+    static constexpr size_t capacity() { return N; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // 0 is the oldest element
+    T& operator[](size_t i)
+    {
+        NG_ASSERT(i < size_);
+        return slots_[(head_ + i) % N];
+    }
+    const T& operator[](size_t i) const
+    {
+        return const_cast<RingBuffer&>(*this)[i];
+    }
+
+    T& front() { return (*this)[0]; }
+    const T& front() const { return (*this)[0]; }
+    T& back() { return (*this)[size_ - 1]; }
+    const T& back() const { return (*this)[size_ - 1]; }
+
+    // Stale contents: the caller has to overwrite all of the slot
+    T& pushBack()
+    {
+        if (size_ == N) {
+            popFront();
+        }
+        ++size_;
+        return back();
+    }
+
+    void popFront()
+    {
+        NG_ASSERT(size_ > 0);
+        head_ = (head_ + 1) % N;
+        --size_;
+    }
+
+    void clear()
+    {
+        head_ = 0;
+        size_ = 0;
+    }
+
+private:
+    std::array<T, N> slots_{};
+    size_t head_{0};
+    size_t size_{0};
+};
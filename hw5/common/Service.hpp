@@ -2,10 +2,23 @@
 
 #include <enet/enet.h>
 #include <function2/function2.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <ranges>
 #include <span>
+#include <thread>
 #include <type_traits>
 
 #include "assert.hpp"
+#include "Log.hpp"
+#include "Metrics.hpp"
+#include "NetworkThread.hpp"
+#include "PeerTable.hpp"
+#include "profile.hpp"
 #include "common.hpp"
 #include "proto.hpp"
 
@@ -20,30 +33,66 @@
 template<class Derived, bool IS_SERVER = false>
 class Service {
 public:
+    // ENet's own limit, peer ids are 12 bits on the wire
+    static constexpr size_t kMaxPeerCount = ENET_PROTOCOL_MAXIMUM_PEER_ID;
+
     Service(const ENetAddress* address, size_t peerCount, size_t channelLimit)
         : host_{
               enet_host_create(address, peerCount, channelLimit, 0, 0),
               &enet_host_destroy}
     {
+        NG_VERIFY(peerCount <= kMaxPeerCount);
         NG_VERIFY(host_ != nullptr);
+        peers_.resize(host_->peerCount);
+    }
+
+    // What the host is bound to, with the actual port if it was asked for 0
+    const ENetAddress& address() const { return host_->address; }
+
+    // Hands the host over to a dedicated network thread for the rest of the
+    // service's life. Everything else keeps working the same way, poll just
+    // picks up what the thread has already received.
+    void startNetworkThread()
+    {
+        NG_VERIFY(netThread_ == nullptr);
+        netThread_ = std::make_unique<NetworkThread>(host_.get());
     }
 
     template<class F>
     void connect(ENetAddress address, F f)
     {
+        if (netThread_ != nullptr) {
+            // The peer is only known once the network thread gets to it
+            connectsInFlight_.emplace_back(std::forward<F>(f));
+            netThread_->push({
+                .kind = NetworkThread::Command::Kind::Connect,
+                .address = address,
+            });
+            return;
+        }
+
         ENetPeer* peer = enet_host_connect(host_.get(), &address, 2, 0);
         if (peer == nullptr) {
             f(peer);
             return;
         }
-        pending_connect_.emplace(peer, std::forward<F>(f));
+        peerState(peer).pendingConnect = std::forward<F>(f);
     }
 
     template<class F>
     void disconnect(ENetPeer* peer, F f)
     {
-        enet_peer_disconnect_later(peer, 0);
-        pending_disconnect_.emplace(peer, std::forward<F>(f));
+        flushOutbox(peer);
+        if (netThread_ != nullptr) {
+            netThread_->push({
+                .kind = NetworkThread::Command::Kind::Disconnect,
+                .peer = peer,
+                .connectID = peerState(peer).connectID,
+            });
+        } else {
+            enet_peer_disconnect_later(peer, 0);
+        }
+        peerState(peer).pendingDisconnect = std::forward<F>(f);
     }
 
     template<PacketType t>
@@ -56,8 +105,11 @@ public:
         static_assert(
             !requires { typename Packet<t>::Continuation; },
             "Missing continuation argument in send!");
+        flushOutbox(peer, channel);
+        messagesSent(t).add();
+        auto bytes = serialize(packet, {});
         peer_send_ciphered(
-            peer, channel, enet_packet_create(&packet, sizeof(packet), flag));
+            peer, channel, enet_packet_create(bytes.data(), bytes.size(), flag));
     }
 
     template<PacketType t>
@@ -69,18 +121,95 @@ public:
         const Packet<t>& packet,
         std::span<const typename Packet<t>::Continuation> cont)
     {
-        using Cont = typename Packet<t>::Continuation;
-        size_t contSizeBytes = sizeof(Cont) * cont.size();
-        auto enetpacket =
-            enet_packet_create(&packet, sizeof(packet) + contSizeBytes, flag);
-        std::memcpy(enetpacket->data + sizeof(packet), cont.data(), contSizeBytes);
-        peer_send_ciphered(peer, channel, enetpacket);
+        flushOutbox(peer, channel);
+        messagesSent(t).add();
+        auto bytes = serialize(packet, std::as_bytes(cont));
+        peer_send_ciphered(
+            peer, channel, enet_packet_create(bytes.data(), bytes.size(), flag));
+    }
+
+    // Same as send, but the message is only queued. Everything posted to a peer
+    // on the same channel with the same flags goes out as a single ENet packet
+    // on the next poll.
+    template<PacketType t>
+    void post(
+        ENetPeer* peer,
+        enet_uint8 channel,
+        ENetPacketFlag flag,
+        const Packet<t>& packet)
+    {
+        static_assert(
+            !requires { typename Packet<t>::Continuation; },
+            "Missing continuation argument in post!");
+        messagesSent(t).add();
+        postBytes(peer, channel, flag, serialize(packet, {}));
+    }
+
+    template<PacketType t>
+    requires requires { typename Packet<t>::Continuation; }
+    void post(
+        ENetPeer* peer,
+        enet_uint8 channel,
+        ENetPacketFlag flag,
+        const Packet<t>& packet,
+        std::span<const typename Packet<t>::Continuation> cont)
+    {
+        messagesSent(t).add();
+        postBytes(peer, channel, flag, serialize(packet, std::as_bytes(cont)));
+    }
+
+    // Sends one message to every peer in a range. The payload is serialized
+    // once and a single refcounted ENet packet is queued to all peers without
+    // a cipher key; peers with a key get their own ciphered copy.
+    //
+    // Keys are per peer, so only keyless peers (the lobby's clients and
+    // servers) actually share a packet. On the game server every client has a
+    // key and this saves the serialization, not the per-peer copies.
+    template<std::ranges::input_range Peers, PacketType t>
+    requires std::convertible_to<std::ranges::range_reference_t<Peers>, ENetPeer*>
+    void broadcast(
+        Peers&& peers,
+        enet_uint8 channel,
+        ENetPacketFlag flag,
+        const Packet<t>& packet)
+    {
+        static_assert(
+            !requires { typename Packet<t>::Continuation; },
+            "Continuation packets can't be broadcast");
+
+        auto bytes = serialize(packet, {});
+        ENetPacket* shared = nullptr;
+        for (ENetPeer* peer: peers) {
+            flushOutbox(peer, channel);
+            messagesSent(t).add();
+
+            if (!peerState(peer).key.empty()) {
+                peer_send_ciphered(
+                    peer,
+                    channel,
+                    enet_packet_create(bytes.data(), bytes.size(), flag));
+                continue;
+            }
+
+            if (shared == nullptr) {
+                shared = enet_packet_create(bytes.data(), bytes.size(), flag);
+                // Our own reference keeps the packet alive until every peer
+                // got it, even if ENet is done with the first ones already
+                ++shared->referenceCount;
+            }
+            transmit(peer, channel, shared);
+        }
+
+        if (shared != nullptr) {
+            release(shared);
+        }
     }
 
     template<PacketType t>
     void handlePacket(ENetPeer* peer, const Packet<t>&)
     {
-        spdlog::error(
+        NG_LOG_ERROR_EVERY(
+            std::chrono::seconds{1},
             "Unsupported packet {} received from {}:{}",
             t,
             peer->address.host,
@@ -103,137 +232,454 @@ public:
 
     void poll(uint32_t timeoutMs = 30)
     {
-        ENetEvent event;
-        while (enet_host_service(host_.get(), &event, timeoutMs) > 0) {
-            switch (event.type) {
-                case ENET_EVENT_TYPE_CONNECT:
-                    if (auto it = pending_connect_.find(event.peer);
-                        it != pending_connect_.end()) {
-                        std::move(it->second)(event.peer);
-                        pending_connect_.erase(it);
-                    } // only servers can get abrupt connects
-                    else if constexpr (IS_SERVER) {
-                        self().connected(event.peer);
-                    }
-                    break;
+        poll(std::chrono::steady_clock::now() + std::chrono::milliseconds{timeoutMs});
+    }
 
-                case ENET_EVENT_TYPE_DISCONNECT:
-                    keys_.erase(event.peer);
+    // Handles events until the deadline, however busy the host is, so that a
+    // fixed-tick loop can poll until its next tick. Events that are already in
+    // by then are still handled, without waiting for more.
+    void poll(std::chrono::steady_clock::time_point deadline)
+    {
+        NG_PROFILE_SCOPE("Service::poll");
+        static auto& eventsPerPoll = metrics::histogram("net_events_per_poll");
+
+        flushOutboxes();
 
-                    if (auto it = pending_disconnect_.find(event.peer);
-                        it != pending_disconnect_.end()) {
-                        std::move(it->second)();
-                        pending_disconnect_.erase(it);
-                    } else // Clients can get abrupt disconnects
-                    {
-                        self().disconnected(event.peer);
+        ENetEvent event;
+        uint64_t events = 0;
+        Defer recordEvents{[&events]() { eventsPerPoll.record(events); }};
+        if (netThread_ == nullptr) {
+            // Past the deadline: what ENet has already received, then a single
+            // zero-timeout service, then what that brought in. check_events
+            // alone neither sends nor reads the socket, and an overloaded tick
+            // would do no I/O at all.
+            bool serviced = false;
+            while (true) {
+                auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now());
+                int got = 0;
+                if (remaining.count() > 0) {
+                    got = enet_host_service(
+                        host_.get(), &event, static_cast<enet_uint32>(remaining.count()));
+                } else {
+                    got = enet_host_check_events(host_.get(), &event);
+                    if (got == 0 && !serviced) {
+                        // Nothing left to dispatch, so this one does send and receive
+                        got = enet_host_service(host_.get(), &event, 0);
+                        serviced = true;
                     }
+                }
+                if (got <= 0)
                     break;
+                handleEvent(event);
+                ++events;
+            }
+            return;
+        }
 
-                case ENET_EVENT_TYPE_RECEIVE: {
-                    cipherXor(event.peer, event.packet);
-
-                    ENetPeer* peer = event.peer;
-                    uint8_t* data = event.packet->data;
-
-                    auto type =
-                        *reinterpret_cast<PacketType*>(event.packet->data);
-
-                    NG_VERIFY(
-                        static_cast<int>(type) <
-                        static_cast<int>(PacketType::COUNT));
-
-                    auto procPacketType = [type,
-                                           peer,
-                                           data,
-                                           size = event.packet->dataLength,
-                                           this]<PacketType t>() {
-                        if (type == t) {
-                            const Packet<t>& packet =
-                                *reinterpret_cast<const Packet<t>*>(data);
-
-                            if constexpr (requires {
-                                              typename Packet<t>::Continuation;
-                                          }) {
-                                using PacketCont =
-                                    typename Packet<t>::Continuation;
-                                std::span<PacketCont> cont{
-                                    reinterpret_cast<PacketCont*>(
-                                        data + sizeof(Packet<t>)),
-                                    (size - sizeof(Packet<t>)) /
-                                        sizeof(PacketCont)};
-                                if constexpr (requires {
-                                                  self().handlePacket(
-                                                      peer, packet, cont);
-                                              }) {
-                                    self().handlePacket(peer, packet, cont);
-                                } else {
-                                    handlePacket(peer, packet);
-                                }
-                            } else {
-                                // I hoped that it would find the default handlePacket on it's own,
-                                // but two-phase lookup is hard :(
-                                if constexpr (requires {
-                                                  self().handlePacket(
-                                                      peer, packet);
-                                              }) {
-                                    self().handlePacket(peer, packet);
-                                } else {
-                                    handlePacket(peer, packet);
-                                }
-                            }
-                        }
-                    };
-
-                    [&procPacketType]<std::size_t... Is>(
-                        std::index_sequence<Is...>)
-                    {
-                        (...,
-                         procPacketType.template
-                         operator()<static_cast<PacketType>(Is)>());
-                    }
-                    (std::make_index_sequence<static_cast<std::size_t>(
-                         PacketType::COUNT)>{});
+        // The network thread keeps receiving, so past the deadline only take
+        // about one queue's worth instead of draining a flood
+        constexpr uint64_t kMaxLateEvents = 4096;
+        uint64_t lateEvents = 0;
+        NetworkThread::Event netEvent;
+        while (true) {
+            bool late = std::chrono::steady_clock::now() >= deadline;
+            if ((!late || lateEvents++ < kMaxLateEvents) && netThread_->tryPop(netEvent)) {
+                if (netEvent.peer != nullptr &&
+                    (netEvent.type == ENET_EVENT_TYPE_NONE ||
+                     netEvent.type == ENET_EVENT_TYPE_CONNECT)) {
+                    peerState(netEvent.peer).connectID = netEvent.connectID;
+                }
+                handleEvent(netEvent);
+                ++events;
+                continue;
+            }
 
-                    enet_packet_destroy(event.packet);
-                } break;
-                default:
-                    break;
-            };
+            // Once per drained batch, so replies still coalesce under load
+            flushOutboxes();
+            if (late)
+                break;
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+                std::chrono::milliseconds{1}, deadline - std::chrono::steady_clock::now()));
         }
     }
 
     void setKeyForPeer(ENetPeer* peer, std::vector<uint8_t> key)
     {
-        keys_[peer] = std::move(key);
+        // Whatever was posted before must still go out with the old key
+        flushOutbox(peer);
+        peerState(peer).key = std::move(key);
     }
 
 private:
     Derived& self() { return *static_cast<Derived*>(this); }
     const Derived& self() const { return *static_cast<const Derived*>(this); }
 
+    // Framed as PacketType::Batch followed by (varint size, message) pairs
+    struct Outbox {
+        enet_uint8 channel;
+        ENetPacketFlag flag;
+        size_t messages{0};
+        size_t firstMessage{0};
+        std::vector<uint8_t> bytes;
+
+        void clear()
+        {
+            messages = 0;
+            bytes.clear();
+        }
+    };
+
+    struct PeerState {
+        fu2::function<void(ENetPeer*)> pendingConnect;
+        fu2::function<void()> pendingDisconnect;
+        std::vector<uint8_t> key;
+        // Network thread mode only: the connection in this slot as of the last
+        // event handled, commands for the peer are dropped if it is gone
+        enet_uint32 connectID{0};
+
+        // One per channel/flags combination ever used, so just a couple of them
+        std::vector<Outbox> outboxes;
+        bool queued{false};
+
+        // Per slot rather than per connection, created on first use
+        metrics::Counter* bytesSent{nullptr};
+        metrics::Counter* bytesReceived{nullptr};
+    };
+
+    PeerState& peerState(const ENetPeer* peer) { return peers_[peerSlot(peer)]; }
+    const PeerState& peerState(const ENetPeer* peer) const
+    {
+        return peers_[peerSlot(peer)];
+    }
+
+    static metrics::Counter& messagesSent(PacketType type)
+    {
+        static auto counters = perTypeCounters("net_messages_sent_total");
+        return *counters[static_cast<size_t>(type)];
+    }
+
+    static metrics::Counter& messagesReceived(PacketType type)
+    {
+        static auto counters = perTypeCounters("net_messages_received_total");
+        return *counters[static_cast<size_t>(type)];
+    }
+
+    static auto perTypeCounters(std::string_view name)
+    {
+        std::array<metrics::Counter*, kPacketTypeNames.size()> counters;
+        for (size_t i = 0; i < counters.size(); ++i) {
+            counters[i] = &metrics::counter(
+                fmt::format("{}{{type=\"{}\"}}", name, kPacketTypeNames[i]));
+        }
+        return counters;
+    }
+
+    metrics::Counter& peerCounter(
+        const ENetPeer* peer, metrics::Counter* PeerState::*member, std::string_view name)
+    {
+        auto& counter = peerState(peer).*member;
+        if (counter == nullptr) {
+            counter = &metrics::counter(
+                fmt::format("{}{{peer=\"{}\"}}", name, peerSlot(peer)));
+        }
+        return *counter;
+    }
+
     void cipherXor(ENetPeer* peer, ENetPacket* packet) const
     {
-        if (!keys_.contains(peer))
+        auto& key = peerState(peer).key;
+        if (key.empty())
             return;
 
-        auto& key = keys_.at(peer);
-
         for (size_t i = 0; i < packet->dataLength; ++i) {
             *packet->data ^= key[i % key.size()];
         }
     }
 
-    void peer_send_ciphered(
-        ENetPeer* peer, enet_uint8 channelID, ENetPacket* packet) const
+    void handleEvent(ENetEvent& event)
+    {
+        switch (event.type) {
+            case ENET_EVENT_TYPE_NONE: {
+                // Network thread got around to a connect() call
+                auto callback = std::move(connectsInFlight_.front());
+                connectsInFlight_.pop_front();
+                if (event.peer == nullptr) {
+                    std::move(callback)(event.peer);
+                } else {
+                    peerState(event.peer).pendingConnect = std::move(callback);
+                }
+            } break;
+
+            case ENET_EVENT_TYPE_CONNECT:
+                if (auto& state = peerState(event.peer); state.pendingConnect) {
+                    // The callback may well schedule something for this very peer
+                    auto callback = std::exchange(state.pendingConnect, nullptr);
+                    std::move(callback)(event.peer);
+                } // only servers can get abrupt connects
+                else if constexpr (IS_SERVER) {
+                    self().connected(event.peer);
+                }
+                break;
+
+            case ENET_EVENT_TYPE_DISCONNECT: {
+                auto& state = peerState(event.peer);
+                state.key.clear();
+                for (auto& outbox: state.outboxes) {
+                    outbox.clear();
+                }
+                // A failed connect attempt ends up here too
+                state.pendingConnect = nullptr;
+
+                if (state.pendingDisconnect) {
+                    auto callback = std::exchange(state.pendingDisconnect, nullptr);
+                    std::move(callback)();
+                } else // Clients can get abrupt disconnects
+                {
+                    self().disconnected(event.peer);
+                }
+            } break;
+
+            case ENET_EVENT_TYPE_RECEIVE: {
+                static auto& bytesReceived = metrics::counter("net_bytes_received_total");
+                static auto& packetsReceived =
+                    metrics::counter("net_packets_received_total");
+                bytesReceived.add(event.packet->dataLength);
+                packetsReceived.add();
+                peerCounter(
+                    event.peer, &PeerState::bytesReceived, "net_peer_bytes_received_total")
+                    .add(event.packet->dataLength);
+
+                cipherXor(event.peer, event.packet);
+                dispatch(event.peer, event.packet->data, event.packet->dataLength);
+                enet_packet_destroy(event.packet);
+            } break;
+        }
+    }
+
+    // Packets that are only declared (e.g. game packets in the lobby) can't be received
+    template<PacketType t>
+    static constexpr bool kKnownPacket = requires { sizeof(Packet<t>); };
+
+    // Fields are written with the wire schema, the continuation goes after them as is
+    template<PacketType t>
+    std::span<const uint8_t> serialize(
+        const Packet<t>& packet, std::span<const std::byte> cont)
+    {
+        if constexpr (requires { typename Packet<t>::Continuation; }) {
+            static_assert(
+                sizeof(typename Packet<t>::Continuation) == 1,
+                "Continuations are shipped as raw bytes");
+        }
+
+        scratch_.clear();
+        writePacket(scratch_, packet);
+        auto contBytes = reinterpret_cast<const uint8_t*>(cont.data());
+        scratch_.insert(scratch_.end(), contBytes, contBytes + cont.size());
+        return scratch_;
+    }
+
+    void dispatch(ENetPeer* peer, uint8_t* data, size_t size)
+    {
+        wire::Reader reader{{data, size}};
+
+        PacketType type;
+        wire::read(reader, type);
+
+        if (!reader.ok() ||
+            static_cast<int>(type) >= static_cast<int>(PacketType::COUNT)) {
+            NG_LOG_ERROR_EVERY(
+                std::chrono::seconds{1},
+                "Malformed packet received from {}:{}",
+                peer->address.host,
+                peer->address.port);
+            return;
+        }
+
+        if (type == PacketType::Batch) {
+            while (reader.ok() && reader.remaining() > 0) {
+                auto frameSize = reader.varint();
+                auto frame = reader.bytes(frameSize);
+                if (!reader.ok() || frame.empty() ||
+                    frame.front() == static_cast<uint8_t>(PacketType::Batch)) {
+                    NG_LOG_ERROR_EVERY(
+                        std::chrono::seconds{1},
+                        "Malformed batch received from {}:{}",
+                        peer->address.host,
+                        peer->address.port);
+                    return;
+                }
+                dispatch(peer, data + (frame.data() - data), frame.size());
+            }
+            return;
+        }
+
+        messagesReceived(type).add();
+
+        auto procPacketType = [type, peer, data, size, &reader, this]<PacketType t>() {
+            if constexpr (kKnownPacket<t>) {
+                if (type != t)
+                    return;
+
+                Packet<t> packet{};
+                if (!readPacket(reader, packet)) {
+                    NG_LOG_ERROR_EVERY(
+                        std::chrono::seconds{1},
+                        "Truncated packet {} received from {}:{}",
+                        static_cast<int>(t),
+                        peer->address.host,
+                        peer->address.port);
+                    return;
+                }
+
+                if constexpr (requires { typename Packet<t>::Continuation; }) {
+                    using PacketCont = typename Packet<t>::Continuation;
+                    std::span<PacketCont> cont{
+                        reinterpret_cast<PacketCont*>(data + reader.position()),
+                        size - reader.position()};
+                    if constexpr (requires {
+                                      self().handlePacket(peer, packet, cont);
+                                  }) {
+                        self().handlePacket(peer, packet, cont);
+                    } else {
+                        handlePacket(peer, packet);
+                    }
+                } else {
+                    // I hoped that it would find the default handlePacket on it's own,
+                    // but two-phase lookup is hard :(
+                    if constexpr (requires { self().handlePacket(peer, packet); }) {
+                        self().handlePacket(peer, packet);
+                    } else {
+                        handlePacket(peer, packet);
+                    }
+                }
+            }
+        };
+
+        [&procPacketType]<std::size_t... Is>(std::index_sequence<Is...>)
+        {
+            (..., procPacketType.template operator()<static_cast<PacketType>(Is)>());
+        }
+        (std::make_index_sequence<static_cast<std::size_t>(PacketType::COUNT)>{});
+    }
+
+    void postBytes(
+        ENetPeer* peer,
+        enet_uint8 channel,
+        ENetPacketFlag flag,
+        std::span<const uint8_t> message)
+    {
+        auto& state = peerState(peer);
+        auto it = std::find_if(
+            state.outboxes.begin(), state.outboxes.end(), [&](const Outbox& o) {
+                return o.channel == channel && o.flag == flag;
+            });
+        auto& outbox = it != state.outboxes.end()
+            ? *it
+            : state.outboxes.emplace_back(Outbox{.channel = channel, .flag = flag});
+
+        wire::Writer writer{outbox.bytes};
+        if (outbox.bytes.empty()) {
+            wire::write(writer, PacketType::Batch);
+        }
+        writer.varint(message.size());
+        if (outbox.messages++ == 0) {
+            outbox.firstMessage = outbox.bytes.size();
+        }
+        writer.bytes(message);
+
+        if (!std::exchange(state.queued, true)) {
+            queuedPeers_.push_back(peer);
+        }
+    }
+
+    void flushOutbox(Outbox& outbox, ENetPeer* peer)
+    {
+        if (outbox.messages == 0)
+            return;
+
+        // A lone message does not need the batch framing
+        size_t offset = outbox.messages == 1 ? outbox.firstMessage : 0;
+        auto enetpacket = enet_packet_create(
+            outbox.bytes.data() + offset, outbox.bytes.size() - offset, outbox.flag);
+        peer_send_ciphered(peer, outbox.channel, enetpacket);
+        outbox.clear();
+    }
+
+    void flushOutbox(ENetPeer* peer, std::optional<enet_uint8> channel = {})
+    {
+        auto& state = peerState(peer);
+        if (!state.queued)
+            return;
+
+        for (auto& outbox: state.outboxes) {
+            if (!channel.has_value() || outbox.channel == *channel) {
+                flushOutbox(outbox, peer);
+            }
+        }
+    }
+
+    void flushOutboxes()
+    {
+        for (auto* peer: queuedPeers_) {
+            flushOutbox(peer);
+            peerState(peer).queued = false;
+        }
+        queuedPeers_.clear();
+    }
+
+    void peer_send_ciphered(ENetPeer* peer, enet_uint8 channelID, ENetPacket* packet)
     {
         cipherXor(peer, packet);
-        enet_peer_send(peer, channelID, packet);
+        transmit(peer, channelID, packet);
+    }
+
+    // The only two places where outgoing packets meet the host
+    void transmit(ENetPeer* peer, enet_uint8 channelID, ENetPacket* packet)
+    {
+        static auto& bytesSent = metrics::counter("net_bytes_sent_total");
+        static auto& packetsSent = metrics::counter("net_packets_sent_total");
+        bytesSent.add(packet->dataLength);
+        packetsSent.add();
+        peerCounter(peer, &PeerState::bytesSent, "net_peer_bytes_sent_total")
+            .add(packet->dataLength);
+
+        if (netThread_ != nullptr) {
+            netThread_->push({
+                .kind = NetworkThread::Command::Kind::Send,
+                .peer = peer,
+                .connectID = peerState(peer).connectID,
+                .channel = channelID,
+                .packet = packet,
+            });
+        } else if (
+            enet_peer_send(peer, channelID, packet) < 0 &&
+            packet->referenceCount == 0) {
+            enet_packet_destroy(packet);
+        }
+    }
+
+    void release(ENetPacket* packet)
+    {
+        if (netThread_ != nullptr) {
+            netThread_->push({
+                .kind = NetworkThread::Command::Kind::Release,
+                .packet = packet,
+            });
+        } else if (--packet->referenceCount == 0) {
+            enet_packet_destroy(packet);
+        }
     }
 
 private:
     UniquePtr<ENetHost> host_;
-    std::unordered_map<ENetPeer*, fu2::function<void(ENetPeer*)>> pending_connect_;
-    std::unordered_map<ENetPeer*, fu2::function<void()>> pending_disconnect_;
-    std::unordered_map<ENetPeer*, std::vector<uint8_t>> keys_;
+    // Indexed by peerSlot, sized to the host's peer array
+    std::vector<PeerState> peers_;
+    std::vector<ENetPeer*> queuedPeers_;
+    // Serialization buffer reused by every send
+    std::vector<uint8_t> scratch_;
+
+    // Declared after host_, so that the thread is gone before the host is
+    std::unique_ptr<NetworkThread> netThread_;
+    std::deque<fu2::function<void(ENetPeer*)>> connectsInFlight_;
 };
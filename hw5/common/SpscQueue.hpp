@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// Capacity must be a power of two.
+template<class T, size_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    // std::hardware_destructive_interference_size warns about ABI on gcc, so just hardcode it
+    static constexpr size_t kCacheLine = 64;
+
+public:
+    bool tryPush(T value)
+    {
+        auto tail = tail_.load(std::memory_order::relaxed);
+        if (tail - cachedHead_ == Capacity) {
+            cachedHead_ = head_.load(std::memory_order::acquire);
+            if (tail - cachedHead_ == Capacity)
+                return false;
+        }
+
+        slots_[tail & (Capacity - 1)] = std::move(value);
+        tail_.store(tail + 1, std::memory_order::release);
+        return true;
+    }
+
+    bool tryPop(T& out)
+    {
+        auto head = head_.load(std::memory_order::relaxed);
+        if (head == cachedTail_) {
+            cachedTail_ = tail_.load(std::memory_order::acquire);
+            if (head == cachedTail_)
+                return false;
+        }
+
+        out = std::move(slots_[head & (Capacity - 1)]);
+        head_.store(head + 1, std::memory_order::release);
+        return true;
+    }
+
+private:
+    // Consumer side
+    alignas(kCacheLine) std::atomic<size_t> head_{0};
+    size_t cachedTail_{0};
+
+    // Producer side
+    alignas(kCacheLine) std::atomic<size_t> tail_{0};
+    size_t cachedHead_{0};
+
+    alignas(kCacheLine) std::array<T, Capacity> slots_{};
+};
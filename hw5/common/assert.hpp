@@ -42,6 +42,8 @@ template<typename... Ts>
         loc.line(),
         loc.function_name());
     spdlog::critical(message, ts...);
+    // Logging may be asynchronous, make sure this gets out before we die
+    spdlog::shutdown();
     std::abort();
 }
 
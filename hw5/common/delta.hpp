@@ -71,6 +71,12 @@ public:
             delta_encode(last_confirmed_state, new_state.data)};
     }
 
+    // Epochs sent since the one the last delta is based on
+    uint64_t UnconfirmedEpochs() const
+    {
+        return states_.front().epoch - states_.back().epoch;
+    }
+
 private:
     std::deque<DataState> states_;
 };
\ No newline at end of file
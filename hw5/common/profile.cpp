@@ -0,0 +1,176 @@
+#include "profile.hpp"
+
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace profile {
+
+namespace {
+
+// Fields are atomics only so that a dump from another thread is not a data
+// race, the owning thread is the only writer
+struct Event {
+    std::atomic<const char*> name{nullptr};
+    std::atomic<int64_t> startNs{0};
+    std::atomic<int64_t> endNs{0};
+};
+
+struct Ring {
+    uint32_t tid;
+    std::atomic<uint64_t> written{0};
+    std::array<Event, kRingSize> events;
+};
+
+struct Rings {
+    std::mutex mutex;
+    // Rings outlive their threads, so a dump still shows what exited threads did
+    std::vector<std::unique_ptr<Ring>> all;
+};
+
+Rings& rings()
+{
+    static Rings rings;
+    return rings;
+}
+
+Ring& threadRing()
+{
+    thread_local Ring* ring = []() {
+        auto& r = rings();
+        std::lock_guard lock{r.mutex};
+        auto& created = r.all.emplace_back(std::make_unique<Ring>());
+        created->tid = static_cast<uint32_t>(r.all.size());
+        return created.get();
+    }();
+    return *ring;
+}
+
+std::atomic<bool> dumpRequested{false};
+static_assert(std::atomic<bool>::is_always_lock_free);
+
+void onDumpSignal(int)
+{
+    dumpRequested.store(true, std::memory_order::relaxed);
+}
+
+} // namespace
+
+int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void record(const char* name, int64_t startNs, int64_t endNs)
+{
+    auto& ring = threadRing();
+    auto index = ring.written.load(std::memory_order::relaxed);
+    auto& event = ring.events[index % kRingSize];
+    event.name.store(name, std::memory_order::relaxed);
+    event.startNs.store(startNs, std::memory_order::relaxed);
+    event.endNs.store(endNs, std::memory_order::relaxed);
+    ring.written.store(index + 1, std::memory_order::release);
+}
+
+bool dumpChromeTrace(const std::string& path)
+{
+    std::ofstream out{path, std::ios::trunc};
+    if (!out)
+        return false;
+
+    auto pid = static_cast<long>(getpid());
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+
+    auto& r = rings();
+    std::lock_guard lock{r.mutex};
+    for (auto& ring: r.all) {
+        auto end = ring->written.load(std::memory_order::acquire);
+        auto begin = end > kRingSize ? end - kRingSize : 0;
+
+        struct Copy {
+            const char* name;
+            int64_t startNs;
+            int64_t endNs;
+        };
+        std::vector<Copy> copies;
+        copies.reserve(end - begin);
+        for (auto i = begin; i < end; ++i) {
+            auto& event = ring->events[i % kRingSize];
+            copies.push_back({
+                event.name.load(std::memory_order::relaxed),
+                event.startNs.load(std::memory_order::relaxed),
+                event.endNs.load(std::memory_order::relaxed),
+            });
+        }
+
+        // The thread kept going while we copied, whatever it lapped is garbage
+        auto nowWritten = ring->written.load(std::memory_order::acquire);
+        auto firstValid = nowWritten > kRingSize ? nowWritten - kRingSize : 0;
+        for (auto i = std::max(begin, firstValid); i < end; ++i) {
+            auto& copy = copies[i - begin];
+            out << (first ? "" : ",\n")
+                << fmt::format(
+                       "{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":{},\"tid\":{},"
+                       "\"ts\":{:.3f},\"dur\":{:.3f}}}",
+                       copy.name,
+                       pid,
+                       ring->tid,
+                       copy.startNs / 1000.0,
+                       (copy.endNs - copy.startNs) / 1000.0);
+            first = false;
+        }
+    }
+
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+void requestDump()
+{
+    dumpRequested.store(true, std::memory_order::relaxed);
+}
+
+void installSignalTrigger()
+{
+#ifdef SIGUSR1
+    std::signal(SIGUSR1, onDumpSignal);
+#endif
+}
+
+void dumpIfRequested(std::string_view process)
+{
+    if (!dumpRequested.exchange(false, std::memory_order::relaxed))
+        return;
+
+    if constexpr (!kEnabled) {
+        spdlog::warn("Trace requested, but profiling is compiled out (HW5_PROFILE=OFF)");
+        return;
+    }
+
+    static int dumps = 0;
+    auto path = fmt::format("trace-{}-{}-{}.json", process, static_cast<long>(getpid()), dumps++);
+    if (dumpChromeTrace(path)) {
+        spdlog::info("Trace written to {}", path);
+    } else {
+        spdlog::error("Unable to write trace to {}", path);
+    }
+}
+
+} // namespace profile
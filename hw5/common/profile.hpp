@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Scoped timers for the hot paths. Every thread appends finished scopes to its
+// own ring buffer (the last kRingSize of them are kept), and a dump turns all
+// rings into a Chrome trace (chrome://tracing or ui.perfetto.dev).
+//
+// Compiled in only with NG_PROFILE (cmake -DHW5_PROFILE=ON), otherwise the
+// macros expand to nothing at all.
+namespace profile {
+
+#ifdef NG_PROFILE
+inline constexpr bool kEnabled = true;
+#else
+inline constexpr bool kEnabled = false;
+#endif
+
+inline constexpr size_t kRingSize = 1 << 16;
+
+int64_t nowNs();
+
+// name must outlive the process, i.e. be a literal
+void record(const char* name, int64_t startNs, int64_t endNs);
+
+class Scope {
+public:
+    explicit Scope(const char* name) : name_{name}, startNs_{nowNs()} { }
+    ~Scope() { record(name_, startNs_, nowNs()); }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+private:
+    const char* name_;
+    int64_t startNs_;
+};
+
+bool dumpChromeTrace(const std::string& path);
+
+// Asks for a dump from anywhere, including signal handlers
+void requestDump();
+// SIGUSR1 requests a dump, where there is such a signal
+void installSignalTrigger();
+// Call from the main loop: writes trace-<process>-<pid>-<n>.json if requested
+void dumpIfRequested(std::string_view process);
+
+} // namespace profile
+
+#ifdef NG_PROFILE
+#define NG_PROFILE_CONCAT_IMPL(a, b) a##b
+#define NG_PROFILE_CONCAT(a, b) NG_PROFILE_CONCAT_IMPL(a, b)
+#define NG_PROFILE_SCOPE(name) \
+    ::profile::Scope NG_PROFILE_CONCAT(ngProfileScope, __LINE__) { name }
+#else
+#define NG_PROFILE_SCOPE(name) \
+    do {                       \
+    } while (false)
+#endif
+
+#define NG_PROFILE_FUNCTION() NG_PROFILE_SCOPE(__func__)
@@ -1,15 +1,20 @@
 #pragma once
 
 #include <array>
+#include <chrono>
 #include <cstdint>
+#include <string_view>
 
 #include <enet/enet.h>
 
+#include "wire.hpp"
+
 enum class PacketType : uint8_t {
     StartLobby,
     LobbyStarted,
     RegisterClientInLobby,
     RegisterServerInLobby,
+    ServerHeartbeat,
     PlayerJoined,
     PlayerLeft,
     Chat,
@@ -18,9 +23,29 @@ enum class PacketType : uint8_t {
     StateDeltaConfirmation,
     PossessEntity,
     PlayerInput,
+    Batch,
     COUNT,
 };
 
+// For logs and metrics, in the order of PacketType
+inline constexpr std::array<std::string_view, static_cast<size_t>(PacketType::COUNT)>
+    kPacketTypeNames{
+        "StartLobby",
+        "LobbyStarted",
+        "RegisterClientInLobby",
+        "RegisterServerInLobby",
+        "ServerHeartbeat",
+        "PlayerJoined",
+        "PlayerLeft",
+        "Chat",
+        "SetKey",
+        "StateDelta",
+        "StateDeltaConfirmation",
+        "PossessEntity",
+        "PlayerInput",
+        "Batch",
+    };
+
 template<PacketType t>
 struct PacketBase {
     PacketType type{t};
@@ -34,33 +59,83 @@ struct Packet;
     template<>                                \
     struct Packet<PacketType::Name> : PacketBase<PacketType::Name>
 
+template<PacketType t>
+void writePacket(std::vector<uint8_t>& out, const Packet<t>& packet)
+{
+    static_assert(
+        wire::HasFields<Packet<t>> || sizeof(Packet<t>) == sizeof(PacketBase<t>),
+        "Packet has members, but no PROTO_FIELDS");
+    wire::Writer writer{out};
+    wire::write(writer, packet.type);
+    wire::writeFields(writer, packet);
+}
+
+// Expects the reader to be right past the packet type
+template<PacketType t>
+bool readPacket(wire::Reader& reader, Packet<t>& packet)
+{
+    wire::readFields(reader, packet);
+    return reader.ok();
+}
+
+// Several messages coalesced by Service::post, see Service::Outbox
+PROTO_IMPL_PACKET(Batch){};
+
 PROTO_IMPL_PACKET(StartLobby){};
 
 PROTO_IMPL_PACKET(LobbyStarted)
 {
     ENetAddress serverAddress;
+
+    PROTO_FIELDS(serverAddress)
 };
 
 PROTO_IMPL_PACKET(RegisterClientInLobby){};
 PROTO_IMPL_PACKET(RegisterServerInLobby){};
 
+// Sent by game servers to the lobby every kHeartbeatInterval, the lobby
+// forgets servers it has not heard from in kServerTimeout
+PROTO_IMPL_PACKET(ServerHeartbeat)
+{
+    static constexpr auto kHeartbeatInterval = std::chrono::seconds{1};
+    static constexpr auto kServerTimeout = std::chrono::seconds{3};
+
+    // Average over the last interval
+    uint32_t tickTimeUs;
+    uint32_t players;
+    // Matches the server can still take
+    uint32_t freeRooms;
+    // Largest match a room can hold
+    uint32_t maxPlayers;
+
+    PROTO_FIELDS(tickTimeUs, players, freeRooms, maxPlayers)
+};
+
 PROTO_IMPL_PACKET(PlayerJoined)
 {
     uint32_t id;
+
+    PROTO_FIELDS(id)
 };
 
 PROTO_IMPL_PACKET(PlayerLeft)
 {
     uint32_t id;
+
+    PROTO_FIELDS(id)
 };
 
 PROTO_IMPL_PACKET(Chat)
 {
     uint32_t player;
     std::array<char, 1000> message;
+
+    PROTO_FIELDS(player, message)
 };
 
 PROTO_IMPL_PACKET(SetKey)
 {
     std::array<uint8_t, 16> key;
+
+    PROTO_FIELDS(key)
 };
\ No newline at end of file
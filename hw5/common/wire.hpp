@@ -0,0 +1,253 @@
+#pragma once
+
+#include <enet/enet.h>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+// Wire format for packets: unsigned ints are LEB128 varints, signed ones are
+// zigzagged first, floats are 4 little-endian bytes and strings are
+// length-prefixed. Which members go on the wire is declared with PROTO_FIELDS.
+namespace wire {
+
+class Writer {
+public:
+    explicit Writer(std::vector<uint8_t>& out) : out_{out} { }
+
+    void varint(uint64_t value)
+    {
+        while (value >= 0x80) {
+            out_.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        out_.push_back(static_cast<uint8_t>(value));
+    }
+
+    void fixed32(uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i) {
+            out_.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    void bytes(std::span<const uint8_t> bytes)
+    {
+        out_.insert(out_.end(), bytes.begin(), bytes.end());
+    }
+
+private:
+    std::vector<uint8_t>& out_;
+};
+
+// Never reads past the end; once something does not fit, ok() is false for good
+class Reader {
+public:
+    explicit Reader(std::span<const uint8_t> in) : in_{in} { }
+
+    uint64_t varint()
+    {
+        uint64_t result = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (!ensure(1))
+                return 0;
+            uint8_t byte = in_[pos_++];
+            result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+                return result;
+        }
+        ok_ = false;
+        return 0;
+    }
+
+    uint32_t fixed32()
+    {
+        if (!ensure(4))
+            return 0;
+        uint32_t result = 0;
+        for (int i = 0; i < 4; ++i) {
+            result |= static_cast<uint32_t>(in_[pos_++]) << (8 * i);
+        }
+        return result;
+    }
+
+    std::span<const uint8_t> bytes(size_t count)
+    {
+        if (!ensure(count))
+            return {};
+        auto result = in_.subspan(pos_, count);
+        pos_ += count;
+        return result;
+    }
+
+    std::span<const uint8_t> rest() { return bytes(in_.size() - pos_); }
+
+    size_t position() const { return pos_; }
+    size_t remaining() const { return in_.size() - pos_; }
+    bool ok() const { return ok_; }
+
+private:
+    bool ensure(size_t count)
+    {
+        ok_ = ok_ && in_.size() - pos_ >= count;
+        return ok_;
+    }
+
+private:
+    std::span<const uint8_t> in_;
+    size_t pos_{0};
+    bool ok_{true};
+};
+
+template<std::unsigned_integral T>
+void write(Writer& w, T value)
+{
+    w.varint(value);
+}
+
+template<std::unsigned_integral T>
+void read(Reader& r, T& value)
+{
+    value = static_cast<T>(r.varint());
+}
+
+template<std::signed_integral T>
+void write(Writer& w, T value)
+{
+    auto wide = static_cast<int64_t>(value);
+    w.varint(static_cast<uint64_t>((wide << 1) ^ (wide >> 63)));
+}
+
+template<std::signed_integral T>
+void read(Reader& r, T& value)
+{
+    auto u = r.varint();
+    value = static_cast<T>((u >> 1) ^ (~(u & 1) + 1));
+}
+
+template<class T>
+requires std::is_enum_v<T>
+void write(Writer& w, T value)
+{
+    write(w, static_cast<std::underlying_type_t<T>>(value));
+}
+
+template<class T>
+requires std::is_enum_v<T>
+void read(Reader& r, T& value)
+{
+    std::underlying_type_t<T> raw;
+    read(r, raw);
+    value = static_cast<T>(raw);
+}
+
+inline void write(Writer& w, float value)
+{
+    w.fixed32(std::bit_cast<uint32_t>(value));
+}
+
+inline void read(Reader& r, float& value)
+{
+    value = std::bit_cast<float>(r.fixed32());
+}
+
+// host is already in network byte order, so it goes out as is
+inline void write(Writer& w, const ENetAddress& address)
+{
+    w.bytes(
+        {reinterpret_cast<const uint8_t*>(&address.host), sizeof(address.host)});
+    write(w, address.port);
+}
+
+inline void read(Reader& r, ENetAddress& address)
+{
+    auto host = r.bytes(sizeof(address.host));
+    if (!host.empty()) {
+        std::memcpy(&address.host, host.data(), host.size());
+    }
+    read(r, address.port);
+}
+
+// Fixed size char buffers hold C strings, only the used part is sent
+template<size_t N>
+void write(Writer& w, const std::array<char, N>& str)
+{
+    size_t length = strnlen(str.data(), N);
+    w.varint(length);
+    w.bytes({reinterpret_cast<const uint8_t*>(str.data()), length});
+}
+
+template<size_t N>
+void read(Reader& r, std::array<char, N>& str)
+{
+    str.fill(0);
+    auto length = r.varint();
+    auto bytes = r.bytes(length);
+    std::memcpy(str.data(), bytes.data(), std::min(bytes.size(), N - 1));
+}
+
+template<size_t N>
+void write(Writer& w, const std::array<uint8_t, N>& bytes)
+{
+    w.bytes(bytes);
+}
+
+template<size_t N>
+void read(Reader& r, std::array<uint8_t, N>& bytes)
+{
+    auto in = r.bytes(N);
+    if (!in.empty()) {
+        std::memcpy(bytes.data(), in.data(), N);
+    }
+}
+
+// Any other fixed size array goes element by element
+template<class T, size_t N>
+void write(Writer& w, const std::array<T, N>& values)
+{
+    for (const auto& value: values) {
+        write(w, value);
+    }
+}
+
+template<class T, size_t N>
+void read(Reader& r, std::array<T, N>& values)
+{
+    for (auto& value: values) {
+        read(r, value);
+    }
+}
+
+template<class P>
+concept HasFields = requires(P& p) { p.fields(); };
+
+template<class P>
+void writeFields(Writer& w, const P& packet)
+{
+    if constexpr (HasFields<P>) {
+        std::apply(
+            [&w](const auto&... f) { (write(w, f), ...); }, packet.fields());
+    }
+}
+
+template<class P>
+void readFields(Reader& r, P& packet)
+{
+    if constexpr (HasFields<P>) {
+        std::apply([&r](auto&... f) { (read(r, f), ...); }, packet.fields());
+    }
+}
+
+} // namespace wire
+
+// Lists the members of a packet that go on the wire, in order.
+// Packets without any can skip it.
+#define PROTO_FIELDS(...)                           \
+    auto fields() { return std::tie(__VA_ARGS__); } \
+    auto fields() const { return std::tie(__VA_ARGS__); }
@@ -2,6 +2,7 @@
 
 #include <cmath>
 #include <glm/glm.hpp>
+#include <algorithm>
 #include <array>
 #include <cstdint>
 #include <limits>
@@ -23,3 +24,11 @@ struct Entity {
     static Entity create();
     static glm::vec2 randomPos();
 };
+
+// Binary search, for arrays sorted by id like the server keeps its entities
+template<class Entities>
+auto* findById(Entities& entities, id_t id)
+{
+    auto it = std::ranges::lower_bound(entities, id, {}, &Entity::id);
+    return it != std::ranges::end(entities) && it->id == id ? &*it : nullptr;
+}
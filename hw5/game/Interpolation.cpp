@@ -0,0 +1,145 @@
+#include "Interpolation.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+void SnapshotInterpolator::blend(
+    std::span<const Entity> prev,
+    std::span<const Entity> target,
+    float t,
+    float sincePrev,
+    std::vector<Entity>& out)
+{
+    out.assign(target.begin(), target.end());
+    from_.resize(out.size());
+    to_.resize(out.size());
+
+    size_t p = 0;
+    for (size_t i = 0; i < out.size(); ++i) {
+        auto& entity = out[i];
+        while (p < prev.size() && prev[p].id < entity.id) {
+            ++p;
+        }
+
+        if (p == prev.size() || prev[p].id != entity.id) {
+            from_[i] = to_[i] = entity.pos;
+        } else if (prev[p].teleport_count != entity.teleport_count) {
+            from_[i] = to_[i] = prev[p].pos + prev[p].vel * sincePrev;
+        } else {
+            from_[i] = prev[p].pos;
+            to_[i] = entity.pos;
+        }
+    }
+
+    // Kept apart from the merge so that it is a plain loop over floats the
+    // compiler can vectorize
+    auto* from = reinterpret_cast<float*>(from_.data());
+    const auto* to = reinterpret_cast<const float*>(to_.data());
+    for (size_t i = 0; i < from_.size() * 2; ++i) {
+        from[i] += (to[i] - from[i]) * t;
+    }
+
+    for (size_t i = 0; i < out.size(); ++i) {
+        out[i].pos = from_[i];
+    }
+}
+
+namespace {
+
+// Weights of a new sample in the running averages
+constexpr float kIntervalGain = 1.f / 8.f;
+constexpr float kJitterGain = 1.f / 16.f;
+constexpr float kLossGain = 1.f / 32.f;
+
+// Deviations past this many times the average jitter are rare enough to stall on
+constexpr float kJitterMargin = 3.f;
+// Chance of a stall we accept from losses in a row
+constexpr float kAcceptedStallRate = 0.01f;
+constexpr int kMaxLossesInARow = 3;
+
+// Seconds of delay gained or shed per second, i.e. how much slower or faster
+// than real time playback goes while the delay moves
+constexpr float kMaxGrowth = 0.25f;
+constexpr float kMaxShrink = 0.05f;
+
+constexpr float kMinDelay = 0.01f;
+constexpr float kMaxDelay = 1.f;
+constexpr float kPaddingHalfLifeSecs = 10.f;
+
+} // namespace
+
+void InterpolationDelay::onSnapshot(Clock::time_point arrival, uint64_t epoch)
+{
+    // A new connection, or the first snapshot
+    if (!lastArrival_.has_value() || epoch <= lastEpoch_) {
+        lastArrival_ = arrival;
+        lastEpoch_ = epoch;
+        return;
+    }
+
+    uint64_t lost = epoch - lastEpoch_ - 1;
+    for (uint64_t i = 0; i < std::min<uint64_t>(lost, 32); ++i) {
+        loss_ += (1.f - loss_) * kLossGain;
+    }
+    loss_ -= loss_ * kLossGain;
+
+    // Spread over the lost ones too, the server's send rate did not change
+    float interval = std::chrono::duration<float>(arrival - *lastArrival_).count() /
+        static_cast<float>(lost + 1);
+    if (samples_ == 0) {
+        interval_ = interval;
+    } else {
+        interval_ += (interval - interval_) * kIntervalGain;
+        jitter_ += (std::abs(interval - interval_) - jitter_) * kJitterGain;
+    }
+    ++samples_;
+
+    lastArrival_ = arrival;
+    lastEpoch_ = epoch;
+}
+
+float InterpolationDelay::target() const
+{
+    if (samples_ < kMinSamples)
+        return kInitialDelay;
+
+    // Smallest run of losses that is rarer than what we accept
+    int lossesInARow = 0;
+    for (float p = 1.f; lossesInARow < kMaxLossesInARow && p * loss_ > kAcceptedStallRate;
+         p *= loss_) {
+        ++lossesInARow;
+    }
+
+    float target = interval_ * static_cast<float>(1 + lossesInARow) +
+        kJitterMargin * jitter_ + padding_;
+    return std::clamp(target, kMinDelay, kMaxDelay);
+}
+
+InterpolationDelay::Clock::duration InterpolationDelay::update(
+    Clock::time_point now, Clock::time_point newest)
+{
+    float elapsed = lastUpdate_.has_value()
+        ? std::chrono::duration<float>(now - *lastUpdate_).count()
+        : 0.f;
+    lastUpdate_ = now;
+
+    padding_ *= std::exp2(-elapsed / kPaddingHalfLifeSecs);
+
+    // Rendering past the newest snapshot: nothing to blend towards. Counted
+    // once per snapshot, the stall lasts until the next one arrives.
+    bool underrun = now - toDuration(delay_) > newest && newest != lastUnderrun_;
+    if (underrun) {
+        lastUnderrun_ = newest;
+        if (samples_ >= kMinSamples) {
+            padding_ = std::min(padding_ + interval_ / 4.f, interval_);
+        }
+    }
+
+    float target = this->target();
+    if (underrun && target > delay_) {
+        delay_ = target;
+    } else {
+        delay_ += std::clamp(target - delay_, -kMaxShrink * elapsed, kMaxGrowth * elapsed);
+    }
+    return toDuration(delay_);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "Entity.hpp"
+
+// Blends two snapshots of the world, both sorted by id (the server keeps its
+// entities that way), in one merge-join pass. Buffers are kept between frames,
+// so once they have grown to the size of the world a frame does not allocate.
+class SnapshotInterpolator {
+public:
+    // Entities only in target are taken as they are, ones only in prev are
+    // gone. Teleported entities are extrapolated from prev by sincePrev seconds
+    // rather than dragged across the map, the rest are lerped by t.
+    // out ends up sorted by id too, and may not alias prev or target.
+    void blend(
+        std::span<const Entity> prev,
+        std::span<const Entity> target,
+        float t,
+        float sincePrev,
+        std::vector<Entity>& out);
+
+private:
+    // Positions to blend between, one pair per entity of out
+    std::vector<glm::vec2> from_;
+    std::vector<glm::vec2> to_;
+};
+
+// How far in the past the client renders, i.e. how many snapshots it keeps
+// buffered ahead of the one it is blending towards. Too little and the
+// buffer runs dry under jitter or loss, too much is latency for nothing,
+// so the target follows the link: one snapshot interval, plus a few times
+// the inter-arrival jitter, plus an interval per loss in a row that is
+// likely enough to plan for.
+//
+// The delay moves towards the target gradually, playback slowing down or
+// speeding up by a few percent, except right after an underrun: the picture
+// is stuck then anyway, so the delay catches up at once.
+class InterpolationDelay {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // The server bumps epoch by one per snapshot it sends, gaps are losses
+    void onSnapshot(Clock::time_point arrival, uint64_t epoch);
+
+    // Call once per frame with the arrival time of the newest snapshot.
+    // Returns the delay to render with.
+    Clock::duration update(Clock::time_point now, Clock::time_point newest);
+
+    Clock::duration delay() const { return toDuration(delay_); }
+    float jitterSecs() const { return jitter_; }
+    // Fraction of snapshots lost, recently
+    float lossRate() const { return loss_; }
+
+private:
+    static Clock::duration toDuration(float secs)
+    {
+        return std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<float>{secs});
+    }
+
+    float target() const;
+
+private:
+    // Used until there are enough samples to go by
+    static constexpr float kInitialDelay = 0.25f;
+    static constexpr int kMinSamples = 8;
+
+    std::optional<Clock::time_point> lastArrival_;
+    uint64_t lastEpoch_{0};
+    int samples_{0};
+
+    // Running averages of the inter-arrival time, its deviation and loss
+    float interval_{0};
+    float jitter_{0};
+    float loss_{0};
+    // Extra margin after underruns the estimate did not see coming, decays
+    float padding_{0};
+
+    float delay_{kInitialDelay};
+    std::optional<Clock::time_point> lastUpdate_;
+    Clock::time_point lastUnderrun_{};
+};
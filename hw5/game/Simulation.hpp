@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+// The player's own entity is stepped in fixed ticks on both sides, with one
+// input per tick. That is what lets the client throw its prediction away and
+// replay it exactly from whatever state the server acknowledges.
+using tick_t = uint32_t;
+
+inline constexpr int kTickRate = 60;
+inline constexpr float kTickSeconds = 1.f / kTickRate;
+inline constexpr std::chrono::nanoseconds kTickInterval{1'000'000'000 / kTickRate};
+
+// What the server does with a desired velocity, so the client must do the same
+inline glm::vec2 sanitizeInput(glm::vec2 vel)
+{
+    float len = glm::length(vel);
+    if (!(len >= 1e-3f))
+        return {0, 0};
+    return vel / len * std::min(len, 1.f);
+}
+
+// Inputs of the last kCapacity ticks, indexed by tick. Ticks start at 1.
+class InputBuffer {
+public:
+    static constexpr size_t kCapacity = 128;
+
+    void store(tick_t tick, glm::vec2 vel) { slots_[tick % kCapacity] = {tick, vel}; }
+
+    const glm::vec2* find(tick_t tick) const
+    {
+        auto& slot = slots_[tick % kCapacity];
+        return tick != 0 && slot.tick == tick ? &slot.vel : nullptr;
+    }
+
+private:
+    struct Slot {
+        tick_t tick{0};
+        glm::vec2 vel{0, 0};
+    };
+
+    std::array<Slot, kCapacity> slots_{};
+};
@@ -2,20 +2,42 @@
 
 #include "../common/proto.hpp"
 #include "Entity.hpp"
+#include "Simulation.hpp"
 
 PROTO_IMPL_PACKET(PossessEntity)
 {
     uint32_t id;
+
+    PROTO_FIELDS(id)
 };
 
 PROTO_IMPL_PACKET(StateDelta)
 {
     uint64_t epoch;
     uint64_t total_bytes;
+    // Last input of the receiving client that the state includes
+    tick_t ackedInputTick;
     using Continuation = uint8_t;
+
+    PROTO_FIELDS(epoch, total_bytes, ackedInputTick)
 };
 
 PROTO_IMPL_PACKET(StateDeltaConfirmation)
 {
     uint64_t epoch;
-};
\ No newline at end of file
+
+    PROTO_FIELDS(epoch)
+};
+
+// Sent by the client every tick, unreliably. Carries the inputs of the last
+// kInputsPerPacket ticks, so losing a few packets in a row loses no input.
+PROTO_IMPL_PACKET(PlayerInput)
+{
+    static constexpr size_t kInputsPerPacket = 8;
+
+    tick_t lastTick;
+    // Desired velocity as x, y pairs, oldest tick first
+    std::array<float, kInputsPerPacket * 2> velocities;
+
+    PROTO_FIELDS(lastTick, velocities)
+};
@@ -0,0 +1,361 @@
+#include <enet/enet.h>
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifdef __unix__
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include "common/assert.hpp"
+#include "common/proto.hpp"
+
+using namespace std::chrono_literals;
+
+// Connection storm against a lobby: opens `clients` connections spread evenly
+// over the ramp, registers every one of them as a client, and reports how long
+// the connects took, how many never made it, and the CPU time both we and
+// (given its pid) the target spent on it.
+//
+// Connections are spread over several hosts, i.e. source ports, so it looks
+// like many machines rather than one with thousands of peers.
+class ConnectionStorm {
+    using Clock = std::chrono::steady_clock;
+
+public:
+    struct Config {
+        size_t clients = 5000;
+        std::chrono::milliseconds ramp{1000};
+        // How long to wait for stragglers once the last connect is out
+        std::chrono::milliseconds timeout{10000};
+        // Connections stay up this long afterwards, e.g. for the lobby to see them
+        std::chrono::milliseconds hold{1000};
+        bool registerInLobby = true;
+    };
+
+    ConnectionStorm(ENetAddress target, Config config)
+        : target_{target}, config_{config}, attempts_(config.clients)
+    {
+        size_t hostCount = (config.clients + kPeersPerHost - 1) / kPeersPerHost;
+        for (size_t i = 0; i < hostCount; ++i) {
+            auto* host = enet_host_create(nullptr, kPeersPerHost, 2, 0, 0);
+            NG_VERIFY(host != nullptr);
+            hosts_.push_back(host);
+        }
+    }
+
+    ~ConnectionStorm()
+    {
+        for (auto* host: hosts_) {
+            for (size_t i = 0; i < host->peerCount; ++i) {
+                if (host->peers[i].state != ENET_PEER_STATE_DISCONNECTED) {
+                    enet_peer_disconnect_now(&host->peers[i], 0);
+                }
+            }
+            enet_host_destroy(host);
+        }
+    }
+
+    ConnectionStorm(const ConnectionStorm&) = delete;
+    ConnectionStorm& operator=(const ConnectionStorm&) = delete;
+
+    void run()
+    {
+        start_ = Clock::now();
+        auto deadline = start_ + config_.ramp + config_.timeout;
+
+        size_t started = 0;
+        while (started < attempts_.size() || pending_ > 0) {
+            auto now = Clock::now();
+            if (now > deadline)
+                break;
+
+            // Connects are paced by the clock, not by how fast they complete
+            size_t due = config_.ramp.count() == 0
+                ? attempts_.size()
+                : std::min(
+                      attempts_.size(),
+                      static_cast<size_t>((now - start_) * attempts_.size() / config_.ramp) +
+                          1);
+            while (started < due) {
+                startAttempt(started++, now);
+            }
+
+            if (!serviceHosts()) {
+                std::this_thread::sleep_for(200us);
+            }
+        }
+        finish_ = Clock::now();
+
+        while (Clock::now() - finish_ < config_.hold) {
+            if (!serviceHosts()) {
+                std::this_thread::sleep_for(1ms);
+            }
+        }
+    }
+
+    void report() const
+    {
+        std::vector<double> latenciesMs;
+        size_t failed = 0;
+        size_t dropped = 0;
+        for (auto& attempt: attempts_) {
+            switch (attempt.state) {
+                case Attempt::State::Connected:
+                    latenciesMs.push_back(
+                        std::chrono::duration<double, std::milli>(
+                            attempt.connected - attempt.started)
+                            .count());
+                    break;
+                case Attempt::State::Failed:
+                    ++failed;
+                    break;
+                case Attempt::State::Dropped:
+                    ++dropped;
+                    break;
+                default:
+                    break;
+            }
+        }
+        std::ranges::sort(latenciesMs);
+
+        auto elapsed = std::chrono::duration<double>(finish_ - start_).count();
+        spdlog::info(
+            "{} connects in {:.2f}s: {} connected ({:.0f}/s), {} refused or timed out, "
+            "{} dropped after connecting, {} still pending",
+            attempts_.size(),
+            elapsed,
+            latenciesMs.size(),
+            latenciesMs.size() / elapsed,
+            failed,
+            dropped,
+            pending_);
+
+        if (!latenciesMs.empty()) {
+            auto at = [&](double p) {
+                return latenciesMs[std::min(
+                    latenciesMs.size() - 1, static_cast<size_t>(p * latenciesMs.size()))];
+            };
+            spdlog::info(
+                "connect latency ms: p50 {:.1f}, p90 {:.1f}, p99 {:.1f}, max {:.1f}",
+                at(0.5),
+                at(0.9),
+                at(0.99),
+                latenciesMs.back());
+        }
+    }
+
+private:
+    static constexpr size_t kPeersPerHost = 256;
+
+    struct Attempt {
+        enum class State {
+            NotStarted,
+            Pending,
+            Connected,
+            // Never got connected: the target is full, or did not answer in time
+            Failed,
+            Dropped,
+        };
+
+        State state{State::NotStarted};
+        Clock::time_point started;
+        Clock::time_point connected;
+    };
+
+    bool serviceHosts()
+    {
+        bool any = false;
+        for (auto* host: hosts_) {
+            ENetEvent event;
+            while (enet_host_service(host, &event, 0) > 0) {
+                handleEvent(event);
+                any = true;
+            }
+        }
+        return any;
+    }
+
+    void startAttempt(size_t index, Clock::time_point now)
+    {
+        auto& attempt = attempts_[index];
+        attempt.started = now;
+
+        auto* peer = enet_host_connect(hosts_[index / kPeersPerHost], &target_, 2, 0);
+        if (peer == nullptr) {
+            attempt.state = Attempt::State::Failed;
+            return;
+        }
+        peer->data = reinterpret_cast<void*>(index);
+        attempt.state = Attempt::State::Pending;
+        ++pending_;
+    }
+
+    void handleEvent(ENetEvent& event)
+    {
+        auto& attempt = attempts_[reinterpret_cast<size_t>(event.peer->data)];
+        switch (event.type) {
+            case ENET_EVENT_TYPE_CONNECT:
+                attempt.connected = Clock::now();
+                attempt.state = Attempt::State::Connected;
+                --pending_;
+                if (config_.registerInLobby) {
+                    std::vector<uint8_t> bytes;
+                    writePacket(bytes, PRegisterClientInLobby{});
+                    enet_peer_send(
+                        event.peer,
+                        0,
+                        enet_packet_create(
+                            bytes.data(), bytes.size(), ENET_PACKET_FLAG_RELIABLE));
+                }
+                break;
+
+            case ENET_EVENT_TYPE_DISCONNECT:
+                if (attempt.state == Attempt::State::Pending) {
+                    attempt.state = Attempt::State::Failed;
+                    --pending_;
+                } else {
+                    attempt.state = Attempt::State::Dropped;
+                }
+                break;
+
+            case ENET_EVENT_TYPE_RECEIVE:
+                enet_packet_destroy(event.packet);
+                break;
+
+            case ENET_EVENT_TYPE_NONE:
+                break;
+        }
+    }
+
+private:
+    ENetAddress target_;
+    Config config_;
+    std::vector<ENetHost*> hosts_;
+    std::vector<Attempt> attempts_;
+    size_t pending_{0};
+    Clock::time_point start_;
+    Clock::time_point finish_;
+};
+
+// User + system CPU time of this process
+std::chrono::duration<double> ownCpuTime()
+{
+#ifdef __unix__
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    auto seconds = [](const timeval& t) { return t.tv_sec + t.tv_usec / 1e6; };
+    return std::chrono::duration<double>{seconds(usage.ru_utime) + seconds(usage.ru_stime)};
+#else
+    return {};
+#endif
+}
+
+// User + system CPU time of another process, where /proc has it
+std::optional<std::chrono::duration<double>> processCpuTime([[maybe_unused]] long pid)
+{
+#ifdef __linux__
+    std::ifstream in{fmt::format("/proc/{}/stat", pid)};
+    std::string stat;
+    if (!std::getline(in, stat))
+        return {};
+
+    // The command name may contain spaces, the fields after it do not
+    std::istringstream fields{stat.substr(stat.rfind(')') + 2)};
+    std::string field;
+    double ticks = 0;
+    // utime and stime are the 14th and 15th fields, the 12th and 13th after the name
+    for (int i = 0; i < 13 && fields >> field; ++i) {
+        if (i >= 11)
+            ticks += std::strtod(field.c_str(), nullptr);
+    }
+    return std::chrono::duration<double>{ticks / sysconf(_SC_CLK_TCK)};
+#else
+    return {};
+#endif
+}
+
+int main(int argc, char** argv)
+{
+    auto usage = [argv]() {
+        spdlog::error(
+            "Usage: {} <lobby addr> <lobby port> [--clients n] [--ramp ms] [--timeout ms] "
+            "[--hold ms] [--no-register] [--pid <target pid>]\n",
+            argv[0]);
+        return -1;
+    };
+    if (argc < 3)
+        return usage();
+
+    ConnectionStorm::Config config;
+    long targetPid = 0;
+    for (int i = 3; i < argc; ++i) {
+        std::string_view option{argv[i]};
+        if (option == "--no-register") {
+            config.registerInLobby = false;
+            continue;
+        }
+        if (i + 1 >= argc)
+            return usage();
+        const char* value = argv[++i];
+        if (option == "--clients") {
+            config.clients = static_cast<size_t>(std::atoi(value));
+        } else if (option == "--ramp") {
+            config.ramp = std::chrono::milliseconds{std::atoi(value)};
+        } else if (option == "--timeout") {
+            config.timeout = std::chrono::milliseconds{std::atoi(value)};
+        } else if (option == "--hold") {
+            config.hold = std::chrono::milliseconds{std::atoi(value)};
+        } else if (option == "--pid") {
+            targetPid = std::atol(value);
+        } else {
+            return usage();
+        }
+    }
+
+    NG_VERIFY(enet_initialize() == 0);
+    std::atexit(enet_deinitialize);
+
+    ENetAddress target;
+    NG_VERIFY(enet_address_set_host(&target, argv[1]) == 0);
+    target.port = static_cast<uint16_t>(std::atoi(argv[2]));
+
+    spdlog::info(
+        "Connecting {} clients to {}:{} over {}ms",
+        config.clients,
+        argv[1],
+        target.port,
+        config.ramp.count());
+
+    auto targetCpuBefore =
+        targetPid != 0 ? processCpuTime(targetPid) : std::nullopt;
+    auto ownCpuBefore = ownCpuTime();
+
+    ConnectionStorm storm(target, config);
+    storm.run();
+
+    auto ownCpu = ownCpuTime() - ownCpuBefore;
+    storm.report();
+    spdlog::info("loadgen cpu: {:.2f}s", ownCpu.count());
+    if (targetPid != 0) {
+        auto targetCpuAfter = processCpuTime(targetPid);
+        if (targetCpuBefore.has_value() && targetCpuAfter.has_value()) {
+            spdlog::info(
+                "target cpu: {:.2f}s", (*targetCpuAfter - *targetCpuBefore).count());
+        } else {
+            spdlog::warn("Unable to read the CPU time of process {}", targetPid);
+        }
+    }
+
+    return 0;
+}
@@ -1,46 +1,106 @@
 #include <spdlog/spdlog.h>
+#include <algorithm>
 #include <chrono>
+#include <csignal>
+#include <filesystem>
 #include <iostream>
-#include <unordered_set>
+#include <tuple>
+#include <vector>
 
 #include "common/AsyncInput.hpp"
+#include "common/Log.hpp"
+#include "common/Metrics.hpp"
+#include "common/PeerTable.hpp"
 #include "common/Service.hpp"
 #include "common/assert.hpp"
 #include "common/common.hpp"
+#include "common/profile.hpp"
 #include "common/proto.hpp"
 
+#include "ServerPool.hpp"
+
 using namespace std::chrono_literals;
 
+namespace {
+
+// Set from SIGINT/SIGTERM, so that run() returns and the pool's destructor
+// takes the spawned servers down with the lobby
+volatile std::sig_atomic_t stopRequested = 0;
+
+void onStopSignal(int)
+{
+    stopRequested = 1;
+}
+
+} // namespace
+
 class LobbyService : public Service<LobbyService, true> {
     using Clock = std::chrono::steady_clock;
 
 public:
-    LobbyService(ENetAddress addr) : Service(&addr, 32, 2) { }
+    LobbyService(
+        ENetAddress addr, size_t peerCount, size_t matchSize, ServerPool::Config pool)
+        : Service(&addr, peerCount, 2), matchSize_{matchSize}, pool_{std::move(pool)}
+    {
+    }
 
+    // Everyone waiting is split into matches of up to matchSize_ players,
+    // each going to whichever server is least loaded at that point
     void handlePacket(ENetPeer*, const PStartLobby&)
     {
-        if (servers_.empty()) {
-            spdlog::error("No servers to send clients to!");
-            return;
+        // Longest waiting first, in case there is not enough room for everyone
+        std::vector<std::pair<Clock::time_point, ENetPeer*>> waiting;
+        waiting.reserve(clients_.size());
+        for (auto& [client, since]: clients_) {
+            waiting.emplace_back(since, client);
         }
+        std::ranges::sort(waiting);
 
-        auto server = servers_.front();
-        servers_.pop_front();
+        std::vector<ENetPeer*> match;
+        size_t next = 0;
+        while (next < waiting.size()) {
+            auto* server = pickServer();
+            if (server == nullptr) {
+                spdlog::error(
+                    "No servers to send {} clients to, they stay in the lobby!",
+                    waiting.size() - next);
+                return;
+            }
 
-        spdlog::info(
-            "Sending {} clients to server {}:{}!",
-            clients_.size(),
-            server.host,
-            server.port);
-
-        for (auto peer: clients_) {
-            send(
-                peer,
+            auto size = std::min({
+                matchSize_,
+                static_cast<size_t>(server->load.maxPlayers),
+                waiting.size() - next,
+            });
+            match.clear();
+            for (size_t i = 0; i < size; ++i) {
+                match.push_back(waiting[next++].second);
+            }
+
+            spdlog::info(
+                "Sending {} clients to server {}:{} ({} players, {}us ticks)!",
+                match.size(),
+                server->address.host,
+                server->address.port,
+                server->load.players,
+                server->load.tickTimeUs);
+
+            // Until its heartbeats catch up, assume the match is already there
+            server->load.freeRooms -= 1;
+            server->load.players += static_cast<uint32_t>(match.size());
+            server->reservedUntil = Clock::now() + kReservationTime;
+
+            broadcast(
+                match,
                 0,
                 ENET_PACKET_FLAG_RELIABLE,
                 PLobbyStarted{
-                    .serverAddress = server,
+                    .serverAddress = server->address,
                 });
+            // They are on their way, a second /begin must not send them elsewhere
+            for (auto* client: match) {
+                clients_.erase(client);
+            }
         }
     }
 
@@ -50,7 +110,9 @@ public:
             "Client {}:{} registered",
             client->address.host,
             client->address.port);
-        clients_.emplace(client);
+        if (!clients_.contains(client)) {
+            clients_.emplace(client, Clock::now());
+        }
     }
 
     void handlePacket(ENetPeer* server, const PRegisterServerInLobby&)
@@ -59,33 +121,165 @@ public:
             "Server {}:{} registered",
             server->address.host,
             server->address.port);
-        servers_.push_back(server->address);
+        if (!servers_.contains(server)) {
+            servers_.emplace(server, ServerData{.address = server->address});
+        }
+        pool_.registered(server->address.port);
+    }
+
+    void handlePacket(ENetPeer* server, const PServerHeartbeat& packet)
+    {
+        auto* data = servers_.find(server);
+        if (data == nullptr) {
+            // Heartbeats overtaking the registration are fine, anything else is not
+            handlePacket(server, PRegisterServerInLobby{});
+            data = &servers_.at(server);
+        }
+
+        auto now = Clock::now();
+        data->lastHeartbeat = now;
+        if (now >= data->reservedUntil || packet.players > 0) {
+            data->load = packet;
+            data->reservedUntil = {};
+        }
     }
 
-    void disconnected(ENetPeer* peer) { clients_.erase(peer); }
+    void disconnected(ENetPeer* peer)
+    {
+        clients_.erase(peer);
+        if (servers_.erase(peer)) {
+            spdlog::info(
+                "Server {}:{} disconnected",
+                peer->address.host,
+                peer->address.port);
+        }
+    }
 
     void run()
     {
         auto lastPollTime = Clock::now();
-        while (true) {
+        auto lastPoolUpdate = lastPollTime - kPoolUpdateInterval;
+        while (stopRequested == 0) {
             auto now = Clock::now();
             auto delta = now - std::exchange(lastPollTime, now);
 
             UNUSED(delta);
 
+            expireServers(now);
+
+            if (pool_.enabled() && now - lastPoolUpdate > kPoolUpdateInterval) {
+                lastPoolUpdate = now;
+                pool_.update(static_cast<size_t>(
+                    std::ranges::count_if(servers_, [](const auto& entry) {
+                        return entry.second.load.freeRooms > 0;
+                    })));
+            }
+
             Service::poll();
+            profile::dumpIfRequested("lobby");
         }
+        spdlog::info("Shutting down");
     }
 
 private:
-    std::unordered_set<ENetPeer*> clients_;
-    std::deque<ENetAddress> servers_;
+    static constexpr auto kReservationTime = 5s;
+    static constexpr auto kPoolUpdateInterval = 250ms;
+
+    struct ServerData {
+        ENetAddress address;
+        Clock::time_point lastHeartbeat{Clock::now()};
+        // Heartbeats sent before the clients got there are stale until then
+        Clock::time_point reservedUntil{};
+        PServerHeartbeat load{};
+    };
+
+    // Fewest players first, tick time breaks ties
+    ServerData* pickServer()
+    {
+        ServerData* best = nullptr;
+        for (auto& [peer, server]: servers_) {
+            if (server.load.freeRooms == 0 || server.load.maxPlayers == 0)
+                continue;
+            if (best == nullptr ||
+                std::tie(server.load.players, server.load.tickTimeUs) <
+                    std::tie(best->load.players, best->load.tickTimeUs)) {
+                best = &server;
+            }
+        }
+        return best;
+    }
+
+    void expireServers(Clock::time_point now)
+    {
+        static auto& serverCount = metrics::gauge("lobby_servers");
+
+        // Erasing reorders the table, so collect first
+        expired_.clear();
+        for (auto& [peer, server]: servers_) {
+            if (now - server.lastHeartbeat > PServerHeartbeat::kServerTimeout) {
+                expired_.push_back(peer);
+            }
+        }
+        for (auto* peer: expired_) {
+            spdlog::warn(
+                "Server {}:{} went silent, dropping it",
+                peer->address.host,
+                peer->address.port);
+            servers_.erase(peer);
+            disconnect(peer, []() {});
+        }
+        serverCount.set(servers_.size());
+    }
+
+    size_t matchSize_;
+    // Waiting clients, with the time they registered
+    PeerTable<Clock::time_point> clients_;
+    PeerTable<ServerData> servers_;
+    std::vector<ENetPeer*> expired_;
+    ServerPool pool_;
 };
 
 int main(int argc, char** argv)
 {
-    if (argc != 2) {
-        spdlog::error("Usage: {} <lobby port>\n", argv[0]);
+    logging::init();
+
+    constexpr size_t kDefaultPeerCount = 32;
+    constexpr size_t kDefaultMatchSize = 16;
+
+    bool netThread = false;
+    size_t peerCount = kDefaultPeerCount;
+    size_t matchSize = kDefaultMatchSize;
+    ServerPool::Config pool;
+    bool argsOk = argc >= 2;
+    for (int i = 2; argsOk && i < argc; ++i) {
+        std::string_view arg{argv[i]};
+        if (arg == "--net-thread") {
+            netThread = true;
+        } else if (arg == "--match-size" && i + 1 < argc) {
+            matchSize = static_cast<size_t>(std::atoi(argv[++i]));
+            argsOk = matchSize > 0;
+        } else if (arg == "--peers" && i + 1 < argc) {
+            peerCount = static_cast<size_t>(std::atoi(argv[++i]));
+            argsOk = peerCount >= 1 && peerCount <= LobbyService::kMaxPeerCount;
+        } else if (arg == "--pool" && i + 1 < argc) {
+            pool.minIdle = static_cast<size_t>(std::atoi(argv[++i]));
+        } else if (arg == "--pool-max" && i + 1 < argc) {
+            pool.maxServers = static_cast<size_t>(std::atoi(argv[++i]));
+        } else if (arg == "--pool-ports" && i + 1 < argc) {
+            pool.firstPort = static_cast<uint16_t>(std::atoi(argv[++i]));
+        } else if (arg == "--server-bin" && i + 1 < argc) {
+            pool.serverPath = argv[++i];
+        } else {
+            argsOk = false;
+        }
+    }
+    if (!argsOk) {
+        spdlog::error(
+            "Usage: {} <lobby port> [--net-thread] [--match-size <players>] "
+            "[--peers <1..{}>] [--pool <idle servers>] [--pool-max <servers>] "
+            "[--pool-ports <first port>] [--server-bin <path>]\n",
+            argv[0],
+            LobbyService::kMaxPeerCount);
         return -1;
     }
 
@@ -97,7 +291,25 @@ int main(int argc, char** argv)
         .port = static_cast<uint16_t>(std::atoi(argv[1])),
     };
 
-    LobbyService lobby(address);
+    // Pooled servers go right after the lobby, next to it on disk by default
+    pool.lobbyPort = address.port;
+    if (pool.firstPort == 0) {
+        pool.firstPort = static_cast<uint16_t>(address.port + 1);
+    }
+    if (pool.serverPath.empty()) {
+        pool.serverPath =
+            (std::filesystem::path{argv[0]}.parent_path() / "hw5_server").string();
+    }
+
+    metrics::exportFromEnv("lobby");
+    profile::installSignalTrigger();
+    std::signal(SIGINT, onStopSignal);
+    std::signal(SIGTERM, onStopSignal);
+
+    LobbyService lobby(address, peerCount, matchSize, std::move(pool));
+    if (netThread) {
+        lobby.startNetworkThread();
+    }
 
     lobby.run();
 
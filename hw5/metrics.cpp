@@ -0,0 +1,186 @@
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Live view of a file written by metrics::Registry::startExport. Counters are
+// shown along with their rate since the previous refresh, histograms as a
+// count and a few percentiles (bucket upper bounds, so they round up).
+
+using Clock = std::chrono::steady_clock;
+
+struct Histogram {
+    // (le, cumulative count), in file order which is ascending
+    std::vector<std::pair<std::string, double>> buckets;
+    double sum = 0;
+    double count = 0;
+
+    std::string percentile(double p) const
+    {
+        for (auto& [le, cumulative]: buckets) {
+            if (cumulative >= p * count)
+                return le;
+        }
+        return "-";
+    }
+};
+
+struct Snapshot {
+    Clock::time_point time;
+    std::map<std::string, double> counters;
+    std::map<std::string, double> gauges;
+    std::map<std::string, Histogram> histograms;
+};
+
+// `base_bucket{a="b",le="7"}` -> (`base{a="b"}`, `7`)
+std::pair<std::string, std::string> splitBucket(
+    const std::string& series, const std::string& base)
+{
+    auto open = series.find('{');
+    std::string labels =
+        open == std::string::npos ? "" : series.substr(open + 1, series.size() - open - 2);
+
+    std::string le;
+    auto lePos = labels.find("le=\"");
+    if (lePos != std::string::npos) {
+        auto end = labels.find('"', lePos + 4);
+        le = labels.substr(lePos + 4, end - lePos - 4);
+        auto eraseFrom = lePos > 0 ? lePos - 1 : lePos; // with the comma before it
+        labels.erase(eraseFrom, end + 1 - eraseFrom);
+    }
+
+    return {labels.empty() ? base : fmt::format("{}{{{}}}", base, labels), le};
+}
+
+// `base_count{a="b"}` -> `base{a="b"}`
+std::string stripSuffix(const std::string& series, size_t baseLength, size_t suffixLength)
+{
+    return series.substr(0, baseLength) + series.substr(baseLength + suffixLength);
+}
+
+bool readSnapshot(const std::string& path, Snapshot& snapshot)
+{
+    std::ifstream in{path};
+    if (!in)
+        return false;
+
+    snapshot = Snapshot{.time = Clock::now()};
+    std::string line;
+    std::string currentBase;
+    std::string currentType;
+    while (std::getline(in, line)) {
+        if (line.starts_with("# TYPE ")) {
+            std::istringstream header{line.substr(7)};
+            header >> currentBase >> currentType;
+            continue;
+        }
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        auto space = line.rfind(' ');
+        if (space == std::string::npos)
+            continue;
+        std::string series = line.substr(0, space);
+        double value = std::strtod(line.c_str() + space + 1, nullptr);
+
+        if (currentType == "counter") {
+            snapshot.counters[series] = value;
+        } else if (currentType == "gauge") {
+            snapshot.gauges[series] = value;
+        } else if (currentType == "histogram") {
+            auto rest = std::string_view{series}.substr(currentBase.size());
+            if (rest.starts_with("_bucket")) {
+                auto [name, le] = splitBucket(series, currentBase);
+                snapshot.histograms[name].buckets.emplace_back(le, value);
+            } else if (rest.starts_with("_sum")) {
+                snapshot.histograms[stripSuffix(series, currentBase.size(), 4)].sum = value;
+            } else if (rest.starts_with("_count")) {
+                snapshot.histograms[stripSuffix(series, currentBase.size(), 6)].count =
+                    value;
+            }
+        }
+    }
+    return true;
+}
+
+void print(const Snapshot& current, const Snapshot* previous)
+{
+    double elapsed = previous != nullptr
+        ? std::chrono::duration<double>(current.time - previous->time).count()
+        : 0;
+    auto rate = [&](const std::map<std::string, double>& old, const std::string& name, double now) {
+        if (elapsed <= 0)
+            return std::string{"-"};
+        auto it = old.find(name);
+        return fmt::format("{:.1f}/s", (now - (it != old.end() ? it->second : 0)) / elapsed);
+    };
+
+    // Clear the screen and go home, works on any modern terminal
+    std::string out = "\x1b[2J\x1b[H";
+
+    out += fmt::format("{:<60} {:>14} {:>12}\n", "counter", "value", "rate");
+    for (auto& [name, value]: current.counters) {
+        out += fmt::format(
+            "{:<60} {:>14.0f} {:>12}\n",
+            name,
+            value,
+            previous ? rate(previous->counters, name, value) : "-");
+    }
+
+    out += fmt::format("\n{:<60} {:>14}\n", "gauge", "value");
+    for (auto& [name, value]: current.gauges) {
+        out += fmt::format("{:<60} {:>14.0f}\n", name, value);
+    }
+
+    out += fmt::format(
+        "\n{:<40} {:>10} {:>10} {:>10} {:>10} {:>10}\n",
+        "histogram",
+        "count",
+        "mean",
+        "p50<=",
+        "p90<=",
+        "p99<=");
+    for (auto& [name, h]: current.histograms) {
+        out += fmt::format(
+            "{:<40} {:>10.0f} {:>10.1f} {:>10} {:>10} {:>10}\n",
+            name,
+            h.count,
+            h.count > 0 ? h.sum / h.count : 0.0,
+            h.percentile(0.5),
+            h.percentile(0.9),
+            h.percentile(0.99));
+    }
+
+    fmt::print("{}", out);
+    std::fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2 && argc != 3) {
+        spdlog::error("Usage: {} <metrics file> [refresh ms]\n", argv[0]);
+        return -1;
+    }
+    std::string path = argv[1];
+    std::chrono::milliseconds refresh{argc == 3 ? std::atoi(argv[2]) : 1000};
+
+    Snapshot previous;
+    bool havePrevious = false;
+    while (true) {
+        Snapshot current;
+        if (readSnapshot(path, current)) {
+            print(current, havePrevious ? &previous : nullptr);
+            previous = std::move(current);
+            havePrevious = true;
+        } else {
+            spdlog::warn("Waiting for {} to appear", path);
+        }
+        std::this_thread::sleep_for(refresh);
+    }
+}
@@ -0,0 +1,394 @@
+#include <enet/enet.h>
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <queue>
+#include <random>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "common/assert.hpp"
+
+using namespace std::chrono_literals;
+
+// UDP proxy standing in for a bad network between the client and the
+// lobby/server. Every client gets its own upstream socket, so the far side
+// still sees one peer per client. Both directions get the same impairments,
+// applied independently.
+//
+// Decisions come from a single seeded generator, so feeding the same traffic
+// through with the same seed drops and delays the same packets.
+class ImpairmentProxy {
+    using Clock = std::chrono::steady_clock;
+
+public:
+    struct Config {
+        // One way, on top of whatever the real link has
+        std::chrono::milliseconds latency{0};
+        // Delay is uniform in [latency - jitter, latency + jitter]
+        std::chrono::milliseconds jitter{0};
+        double lossPercent = 0;
+        // Share of packets that ignore the ordering of their direction, without
+        // it jitter only bunches packets up
+        double reorderPercent = 0;
+        // Per client and direction, 0 is unlimited
+        uint32_t bandwidthKbps = 0;
+        // Packets that would wait longer than this for the capped link are dropped
+        std::chrono::milliseconds queueLimit{500};
+        uint64_t seed = 0;
+    };
+
+    ImpairmentProxy(ENetAddress listen, ENetAddress upstream, Config config)
+        : upstream_{upstream}, config_{config}, random_{config.seed}
+    {
+        listen_ = openSocket(&listen);
+        NG_VERIFY(listen_ != ENET_SOCKET_NULL);
+    }
+
+    ~ImpairmentProxy()
+    {
+        for (auto& [key, session]: sessions_) {
+            enet_socket_destroy(session.upstream);
+        }
+        enet_socket_destroy(listen_);
+    }
+
+    void run()
+    {
+        while (true) {
+            waitForTraffic();
+
+            auto now = Clock::now();
+            receive(listen_, nullptr, now);
+            for (auto& [key, session]: sessions_) {
+                receive(session.upstream, &session, now);
+            }
+
+            deliverDue(now);
+            expireSessions(now);
+        }
+    }
+
+private:
+    struct Link {
+        // When the capped link is done with everything queued so far
+        Clock::time_point freeAt{};
+        // Latest delivery so far, in-order packets are not let out before it
+        Clock::time_point lastDelivery{};
+    };
+
+    struct Session {
+        ENetAddress client;
+        ENetSocket upstream;
+        Link toUpstream;
+        Link toClient;
+        Clock::time_point lastActivity;
+    };
+
+    struct Datagram {
+        Clock::time_point deliverAt;
+        // Ties are broken by arrival, so equal delays keep the order
+        uint64_t seq;
+        uint64_t session;
+        bool toClient;
+        std::vector<uint8_t> bytes;
+
+        bool operator>(const Datagram& other) const
+        {
+            return std::tie(deliverAt, seq) > std::tie(other.deliverAt, other.seq);
+        }
+    };
+
+    static constexpr size_t kMaxDatagram = 4096;
+    static constexpr auto kSessionTimeout = 60s;
+
+    static std::string describe(const ENetAddress& address)
+    {
+        char ip[64] = "?";
+        enet_address_get_host_ip(&address, ip, sizeof(ip));
+        return fmt::format("{}:{}", ip, address.port);
+    }
+
+    static uint64_t keyOf(const ENetAddress& address)
+    {
+        return (uint64_t{address.host} << 16) | address.port;
+    }
+
+    static ENetSocket openSocket(const ENetAddress* bindTo)
+    {
+        ENetSocket socket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+        if (socket == ENET_SOCKET_NULL)
+            return socket;
+        enet_socket_set_option(socket, ENET_SOCKOPT_NONBLOCK, 1);
+        enet_socket_set_option(socket, ENET_SOCKOPT_RCVBUF, 1 << 20);
+        enet_socket_set_option(socket, ENET_SOCKOPT_SNDBUF, 1 << 20);
+        if (bindTo != nullptr && enet_socket_bind(socket, bindTo) < 0) {
+            enet_socket_destroy(socket);
+            return ENET_SOCKET_NULL;
+        }
+        return socket;
+    }
+
+    void waitForTraffic()
+    {
+        ENetSocketSet readSet;
+        ENET_SOCKETSET_EMPTY(readSet);
+        ENET_SOCKETSET_ADD(readSet, listen_);
+        ENetSocket maxSocket = listen_;
+        for (auto& [key, session]: sessions_) {
+            ENET_SOCKETSET_ADD(readSet, session.upstream);
+            maxSocket = std::max(maxSocket, session.upstream);
+        }
+
+        auto timeout = 100ms;
+        if (!pending_.empty()) {
+            auto untilDue = std::chrono::ceil<std::chrono::milliseconds>(
+                pending_.top().deliverAt - Clock::now());
+            timeout = std::clamp(untilDue, 0ms, timeout);
+        }
+        enet_socketset_select(
+            maxSocket, &readSet, nullptr, static_cast<enet_uint32>(timeout.count()));
+    }
+
+    // Sessions are keyed by client address, so a new client never invalidates
+    // the session being read from
+    void receive(ENetSocket socket, Session* from, Clock::time_point now)
+    {
+        uint8_t data[kMaxDatagram];
+        while (true) {
+            ENetAddress sender;
+            ENetBuffer buffer;
+            buffer.data = data;
+            buffer.dataLength = sizeof(data);
+            int received = enet_socket_receive(socket, &sender, &buffer, 1);
+            if (received <= 0)
+                return;
+
+            Session* session = from;
+            if (session == nullptr) {
+                session = sessionFor(sender, now);
+                if (session == nullptr)
+                    continue;
+            }
+            session->lastActivity = now;
+
+            bool toClient = from != nullptr;
+            impair(*session, toClient, {data, data + received}, now);
+        }
+    }
+
+    Session* sessionFor(const ENetAddress& client, Clock::time_point now)
+    {
+        auto key = keyOf(client);
+        if (auto it = sessions_.find(key); it != sessions_.end())
+            return &it->second;
+
+        ENetSocket upstream = openSocket(nullptr);
+        if (upstream == ENET_SOCKET_NULL) {
+            spdlog::error("Unable to open an upstream socket for a new client");
+            return nullptr;
+        }
+
+        spdlog::info("New client {}", describe(client));
+        return &sessions_
+                    .emplace(
+                        key,
+                        Session{
+                            .client = client,
+                            .upstream = upstream,
+                            .lastActivity = now,
+                        })
+                    .first->second;
+    }
+
+    void impair(
+        Session& session, bool toClient, std::vector<uint8_t> bytes, Clock::time_point now)
+    {
+        // Always draw the same amount of numbers per packet, so that changing
+        // one knob doesn't reshuffle the decisions made by the others
+        double lossRoll = percent_(random_);
+        double reorderRoll = percent_(random_);
+        double jitterRoll = unit_(random_);
+
+        ++stats_.received;
+        if (lossRoll < config_.lossPercent) {
+            ++stats_.lost;
+            return;
+        }
+
+        Link& link = toClient ? session.toClient : session.toUpstream;
+
+        auto sentAt = now;
+        if (config_.bandwidthKbps > 0) {
+            auto start = std::max(link.freeAt, now);
+            if (start - now > config_.queueLimit) {
+                ++stats_.overflowed;
+                return;
+            }
+            // kbit/s is bits per millisecond
+            auto transmit = std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double, std::milli>(
+                    bytes.size() * 8.0 / config_.bandwidthKbps));
+            link.freeAt = start + transmit;
+            sentAt = link.freeAt;
+        }
+
+        auto delay = std::chrono::duration_cast<Clock::duration>(
+            config_.latency + (jitterRoll * 2 - 1) * config_.jitter);
+        auto deliverAt = sentAt + std::max(delay, Clock::duration::zero());
+
+        if (reorderRoll < config_.reorderPercent) {
+            ++stats_.reordered;
+        } else {
+            deliverAt = std::max(deliverAt, link.lastDelivery);
+            link.lastDelivery = deliverAt;
+        }
+
+        pending_.push(Datagram{
+            .deliverAt = deliverAt,
+            .seq = nextSeq_++,
+            .session = keyOf(session.client),
+            .toClient = toClient,
+            .bytes = std::move(bytes),
+        });
+    }
+
+    void deliverDue(Clock::time_point now)
+    {
+        while (!pending_.empty() && pending_.top().deliverAt <= now) {
+            const Datagram& datagram = pending_.top();
+            auto it = sessions_.find(datagram.session);
+            if (it != sessions_.end()) {
+                Session& session = it->second;
+
+                ENetBuffer buffer;
+                buffer.data = const_cast<uint8_t*>(datagram.bytes.data());
+                buffer.dataLength = datagram.bytes.size();
+                if (datagram.toClient)
+                    enet_socket_send(listen_, &session.client, &buffer, 1);
+                else
+                    enet_socket_send(session.upstream, &upstream_, &buffer, 1);
+                ++stats_.delivered;
+            }
+            pending_.pop();
+        }
+
+        if (now - lastReport_ >= 5s) {
+            lastReport_ = now;
+            spdlog::info(
+                "{} clients, {} received, {} delivered, {} lost, {} over bandwidth, {} reordered",
+                sessions_.size(),
+                stats_.received,
+                stats_.delivered,
+                stats_.lost,
+                stats_.overflowed,
+                stats_.reordered);
+        }
+    }
+
+    void expireSessions(Clock::time_point now)
+    {
+        std::erase_if(sessions_, [now](auto& entry) {
+            auto& [key, session] = entry;
+            if (now - session.lastActivity < kSessionTimeout)
+                return false;
+            spdlog::info("Client {} went quiet, dropping it", describe(session.client));
+            enet_socket_destroy(session.upstream);
+            return true;
+        });
+    }
+
+private:
+    ENetSocket listen_;
+    ENetAddress upstream_;
+    Config config_;
+
+    std::unordered_map<uint64_t, Session> sessions_;
+    std::priority_queue<Datagram, std::vector<Datagram>, std::greater<>> pending_;
+    uint64_t nextSeq_{0};
+
+    std::mt19937_64 random_;
+    std::uniform_real_distribution<double> percent_{0, 100};
+    std::uniform_real_distribution<double> unit_{0, 1};
+
+    struct {
+        uint64_t received = 0;
+        uint64_t delivered = 0;
+        uint64_t lost = 0;
+        uint64_t overflowed = 0;
+        uint64_t reordered = 0;
+    } stats_;
+    Clock::time_point lastReport_{Clock::now()};
+};
+
+int main(int argc, char** argv)
+{
+    auto usage = [argv]() {
+        spdlog::error(
+            "Usage: {} <listen port> <upstream addr> <upstream port> [--latency ms] "
+            "[--jitter ms] [--loss %] [--reorder %] [--bandwidth kbit/s] "
+            "[--queue ms] [--seed n]\n",
+            argv[0]);
+        return -1;
+    };
+    if (argc < 4 || (argc - 4) % 2 != 0)
+        return usage();
+
+    ImpairmentProxy::Config config;
+    config.seed = std::random_device{}();
+    for (int i = 4; i < argc; i += 2) {
+        std::string_view option{argv[i]};
+        const char* value = argv[i + 1];
+        if (option == "--latency") {
+            config.latency = std::chrono::milliseconds{std::atoi(value)};
+        } else if (option == "--jitter") {
+            config.jitter = std::chrono::milliseconds{std::atoi(value)};
+        } else if (option == "--loss") {
+            config.lossPercent = std::atof(value);
+        } else if (option == "--reorder") {
+            config.reorderPercent = std::atof(value);
+        } else if (option == "--bandwidth") {
+            config.bandwidthKbps = static_cast<uint32_t>(std::atoi(value));
+        } else if (option == "--queue") {
+            config.queueLimit = std::chrono::milliseconds{std::atoi(value)};
+        } else if (option == "--seed") {
+            config.seed = std::strtoull(value, nullptr, 10);
+        } else {
+            return usage();
+        }
+    }
+
+    NG_VERIFY(enet_initialize() == 0);
+    std::atexit(enet_deinitialize);
+
+    ENetAddress listen{
+        .host = ENET_HOST_ANY,
+        .port = static_cast<uint16_t>(std::atoi(argv[1])),
+    };
+    ENetAddress upstream;
+    NG_VERIFY(enet_address_set_host(&upstream, argv[2]) == 0);
+    upstream.port = static_cast<uint16_t>(std::atoi(argv[3]));
+
+    spdlog::info(
+        "Proxying :{} -> {}:{}, latency {}ms ± {}ms, loss {}%, reorder {}%, "
+        "bandwidth {} kbit/s, seed {}",
+        listen.port,
+        argv[2],
+        upstream.port,
+        config.latency.count(),
+        config.jitter.count(),
+        config.lossPercent,
+        config.reorderPercent,
+        config.bandwidthKbps,
+        config.seed);
+
+    ImpairmentProxy proxy(listen, upstream, config);
+    proxy.run();
+
+    return 0;
+}
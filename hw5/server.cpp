@@ -1,11 +1,15 @@
 #include <spdlog/spdlog.h>
 #include <chrono>
-#include <iostream>
 #include <random>
+#include <ranges>
 #include <unordered_map>
 
+#include "common/Log.hpp"
+#include "common/Metrics.hpp"
+#include "common/PeerTable.hpp"
 #include "common/Service.hpp"
 #include "common/assert.hpp"
+#include "common/profile.hpp"
 #include "common/delta.hpp"
 #include "common/proto.hpp"
 
@@ -18,7 +22,11 @@ class ServerService : public Service<ServerService, true> {
     using Clock = std::chrono::steady_clock;
 
 public:
-    ServerService(ENetAddress addr) : Service(&addr, 32, 2) { resetGame(); }
+    ServerService(ENetAddress addr, size_t peerCount)
+        : Service(&addr, peerCount, 2), peerCount_{peerCount}
+    {
+        resetGame();
+    }
 
     void resetGame()
     {
@@ -35,31 +43,63 @@ public:
         }
     }
 
-    void registerInLobby(char* addr, uint16_t port)
+    // Stays connected to the lobby for heartbeats, reconnecting if it goes away
+    void registerInLobby(ENetAddress lobbyAddress)
     {
-        // kostyl
-        static ENetAddress address;
-        if (addr != nullptr) {
-            enet_address_set_host(&address, addr);
-            address.port = port;
-        }
+        lobbyAddress_ = lobbyAddress;
+        lastLobbyAttempt_ = Clock::now();
 
-        connect(address, [this](ENetPeer* lobby) {
-            NG_VERIFY(lobby != nullptr);
+        connect(lobbyAddress_, [this](ENetPeer* lobby) {
+            if (lobby == nullptr) {
+                spdlog::warn("Unable to connect to the lobby, will retry");
+                return;
+            }
+            if (lobby_ != nullptr) {
+                // An older attempt got through after all
+                disconnect(lobby, []() {});
+                return;
+            }
+            lobby_ = lobby;
             send(lobby, 0, ENET_PACKET_FLAG_RELIABLE, PRegisterServerInLobby{});
-            disconnect(lobby, []() {});
+            sendHeartbeat();
         });
     }
 
+    void sendHeartbeat()
+    {
+        if (lobby_ == nullptr)
+            return;
+
+        auto ticks = std::exchange(ticksSinceHeartbeat_, 0);
+        auto tickTime = std::exchange(tickTimeSinceHeartbeat_, Clock::duration{});
+        post(
+            lobby_,
+            0,
+            {},
+            PServerHeartbeat{
+                .tickTimeUs = ticks == 0
+                    ? 0
+                    : static_cast<uint32_t>(
+                          std::chrono::duration_cast<std::chrono::microseconds>(tickTime)
+                              .count() /
+                          ticks),
+                .players = static_cast<uint32_t>(clients_.size()),
+                // One match at a time, and a fresh one can start once everyone is gone
+                .freeRooms = clients_.empty() ? 1u : 0u,
+                // The lobby takes up one peer
+                .maxPlayers = static_cast<uint32_t>(peerCount_ - 1),
+            });
+    }
+
     void handlePacket(ENetPeer* peer, PChat packet)
     {
         packet.player = clients_.at(peer).id;
-        for (auto& [client, data]: clients_) {
-            if (client == peer)
-                continue;
-
-            send(client, 1, {}, packet);
-        }
+        broadcast(
+            clients_.peers() |
+                std::views::filter([peer](ENetPeer* p) { return p != peer; }),
+            1,
+            {},
+            packet);
     }
 
     void connected(ENetPeer* peer)
@@ -100,7 +140,7 @@ public:
                 .entityId = created.id,
             });
 
-        send(
+        post(
             peer,
             0,
             ENET_PACKET_FLAG_RELIABLE,
@@ -112,86 +152,89 @@ public:
             if (client == peer)
                 continue;
 
-            send(client, 0, ENET_PACKET_FLAG_RELIABLE, PPlayerJoined{.id = id});
+            post(client, 0, ENET_PACKET_FLAG_RELIABLE, PPlayerJoined{.id = id});
 
-            send(peer, 0, ENET_PACKET_FLAG_RELIABLE, PPlayerJoined{.id = data.id});
+            post(peer, 0, ENET_PACKET_FLAG_RELIABLE, PPlayerJoined{.id = data.id});
         }
 
         send_deltas();
     }
 
-    Entity* entityById(id_t id)
-    {
-        auto it = std::find_if(
-            entities_.begin(), entities_.end(), [id](const Entity& e) {
-                return e.id == id;
-            });
-        if (it == entities_.end())
-            return nullptr;
-
-        return &*it;
-    }
+    Entity* entityById(id_t id) { return findById(entities_, id); }
 
-    // input delta-compression
-    void handlePacket(
-        ENetPeer* peer, const PStateDelta& packet, std::span<std::uint8_t> cont)
+    void handlePacket(ENetPeer* peer, const PPlayerInput& packet)
     {
-        auto it = clients_.find(peer);
-        if (it == clients_.end())
+        auto* client = clients_.find(peer);
+        if (client == nullptr)
             return;
 
-        auto* entity = entityById(it->second.entityId);
-
-        if (entity == nullptr)
-            return;
+        // Redundant copies of inputs we already have are simply overwritten
+        for (size_t i = 0; i < PPlayerInput::kInputsPerPacket; ++i) {
+            tick_t tick = packet.lastTick - (PPlayerInput::kInputsPerPacket - 1 - i);
+            if (tick > packet.lastTick || tick <= client->appliedInputTick)
+                continue;
+            client->inputs.store(
+                tick,
+                sanitizeInput({packet.velocities[2 * i], packet.velocities[2 * i + 1]}));
+        }
+        client->receivedInputTick = std::max(client->receivedInputTick, packet.lastTick);
+    }
 
-        std::cout << "Applying delta of size " << cont.size() << " at epoch "
-                  << packet.epoch << std::endl;
-        NG_ASSERT(sizeof(entity->vel) == packet.total_bytes);
-        delta_apply(
-            {reinterpret_cast<uint8_t*>(&entity->vel), sizeof(entity->vel)},
-            cont);
-        send(peer, 1, {}, PStateDeltaConfirmation{.epoch = packet.epoch});
+    // One input per client and tick, like the client predicted it
+    void applyInputs()
+    {
+        for (auto& [peer, client]: clients_) {
+            if (client.receivedInputTick <= client.appliedInputTick)
+                continue; // nothing new, keep going with the last one
 
-        float len = glm::length(entity->vel);
+            // Inputs that piled up (a stall on either side) would only add latency
+            if (client.receivedInputTick - client.appliedInputTick > kMaxInputBacklog) {
+                client.appliedInputTick = client.receivedInputTick - kMaxInputBacklog;
+            }
 
-        if (len < 1e-3) {
-            entity->vel = {0, 0};
-            return;
+            // An input that never arrived is treated as a repeat of the previous one
+            auto* vel = client.inputs.find(++client.appliedInputTick);
+            auto* entity = entityById(client.entityId);
+            if (vel != nullptr && entity != nullptr) {
+                entity->vel = *vel;
+            }
         }
-
-        entity->vel = entity->vel / len * std::clamp(len, 0.f, 1.f);
     }
 
     void disconnected(ENetPeer* peer)
     {
+        if (peer == lobby_) {
+            spdlog::warn("Lost connection to the lobby");
+            lobby_ = nullptr;
+            return;
+        }
+
         spdlog::info("{}:{} left", peer->address.host, peer->address.port);
 
-        auto it = clients_.find(peer);
-        if (it == clients_.end()) {
+        auto* client = clients_.find(peer);
+        if (client == nullptr) {
             return;
         }
 
-        auto erasedData = std::move(it->second);
-        clients_.erase(it);
+        auto erasedData = std::move(*client);
+        clients_.erase(peer);
 
-        for (auto& [client, data]: clients_) {
-            send(
-                client,
-                0,
-                ENET_PACKET_FLAG_RELIABLE,
-                PPlayerLeft{.id = erasedData.id});
-        }
+        broadcast(
+            clients_.peers(),
+            0,
+            ENET_PACKET_FLAG_RELIABLE,
+            PPlayerLeft{.id = erasedData.id});
 
         if (clients_.empty()) {
-            spdlog::info("All players left, requeueing in lobby");
+            spdlog::info("All players left, advertising a free room again");
             resetGame();
-            registerInLobby(nullptr, 0);
+            sendHeartbeat();
         }
     }
 
     void updateLogic(float delta)
     {
+        NG_PROFILE_FUNCTION();
         for (auto& entity: entities_) {
             if (botTargets_.contains(entity.id)) {
                 auto v = botTargets_[entity.id] - entity.pos;
@@ -224,15 +267,8 @@ public:
             }
         }
 
-        for (size_t i = 0; i < entities_.size();) {
-            if (entities_[i].size < 1e-3) {
-                auto id = entities_[i].id;
-                std::swap(entities_[i], entities_.back());
-                entities_.pop_back();
-            } else {
-                ++i;
-            }
-        }
+        // Order preserving, so that entities stay sorted by id for the clients
+        std::erase_if(entities_, [](const Entity& e) { return e.size < 1e-3; });
     }
 
     void handlePacket(ENetPeer* peer, const PStateDeltaConfirmation& packet)
@@ -243,17 +279,28 @@ public:
 
     void send_deltas()
     {
+        NG_PROFILE_FUNCTION();
+        static auto& deltaBytes = metrics::histogram("server_delta_bytes");
+        static auto& unconfirmedEpochs =
+            metrics::histogram("server_delta_unconfirmed_epochs");
+
         const std::span state{
             reinterpret_cast<const uint8_t*>(entities_.data()),
             entities_.size() * sizeof(decltype(entities_)::value_type)};
 
         for (auto& [to, client]: clients_) {
             const auto [epoch, delta] = client.delta_queue.GetStateDelta(state);
+            deltaBytes.record(delta.size());
+            unconfirmedEpochs.record(client.delta_queue.UnconfirmedEpochs());
             send(
                 to,
                 1,
                 {},
-                PStateDelta{.epoch = epoch, .total_bytes = state.size()},
+                PStateDelta{
+                    .epoch = epoch,
+                    .total_bytes = state.size(),
+                    .ackedInputTick = client.appliedInputTick,
+                },
                 delta);
         }
     }
@@ -262,20 +309,39 @@ public:
     {
         constexpr auto kSendRate = 100ms;
 
+        auto& tickTime = metrics::histogram("server_tick_us");
+        auto& clients = metrics::gauge("server_clients");
+        auto& entities = metrics::gauge("server_entities");
+
         auto startTime = Clock::now();
-        auto currentTime = startTime;
+        auto nextTick = startTime;
         auto lastSendTime = startTime;
+        auto lastHeartbeatTime = startTime;
 
         while (true) {
             auto now = Clock::now();
-            float delta =
-                std::chrono::duration_cast<std::chrono::duration<float>>(
-                    now - std::exchange(currentTime, now))
-                    .count();
 
-            if (clients_.size() > 0) {
-                updateLogic(delta);
+            // Fixed ticks, clients replay their predictions with the same step
+            if (now - nextTick > kMaxCatchUp) {
+                nextTick = now;
             }
+            while (nextTick <= now) {
+                nextTick += kTickInterval;
+                if (clients_.empty())
+                    continue;
+
+                auto tickStart = Clock::now();
+                applyInputs();
+                updateLogic(kTickSeconds);
+                auto elapsed = Clock::now() - tickStart;
+                tickTime.record(
+                    std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+                        .count());
+                tickTimeSinceHeartbeat_ += elapsed;
+                ++ticksSinceHeartbeat_;
+            }
+            clients.set(clients_.size());
+            entities.set(entities_.size());
 
             if ((now - lastSendTime) > kSendRate) {
                 lastSendTime = now;
@@ -283,29 +349,78 @@ public:
                 send_deltas();
             }
 
-            Service::poll();
+            if ((now - lastHeartbeatTime) > PServerHeartbeat::kHeartbeatInterval) {
+                lastHeartbeatTime = now;
+
+                if (lobby_ != nullptr) {
+                    sendHeartbeat();
+                } else if ((now - lastLobbyAttempt_) > kLobbyRetryInterval) {
+                    registerInLobby(lobbyAddress_);
+                }
+            }
+
+            Service::poll(nextTick);
+            profile::dumpIfRequested("server");
         }
     }
 
 private:
+    static constexpr auto kLobbyRetryInterval = 5s;
+    // Past that ticks are dropped rather than run back to back
+    static constexpr auto kMaxCatchUp = 250ms;
+    static constexpr tick_t kMaxInputBacklog = 6;
+
     struct ClientData {
         uint32_t id;
         id_t entityId;
         DeltaSendQueue delta_queue;
+
+        InputBuffer inputs;
+        tick_t receivedInputTick{0};
+        tick_t appliedInputTick{0};
     };
 
-    std::unordered_map<ENetPeer*, ClientData> clients_;
+    size_t peerCount_;
+    PeerTable<ClientData> clients_;
     uint32_t idCounter_{1};
+    // Sorted by id: ids only grow, and new entities go to the back
     std::vector<Entity> entities_;
 
     std::unordered_map<id_t, glm::vec2> botTargets_;
+
+    ENetAddress lobbyAddress_{};
+    ENetPeer* lobby_{nullptr};
+    Clock::time_point lastLobbyAttempt_{};
+    Clock::duration tickTimeSinceHeartbeat_{};
+    uint32_t ticksSinceHeartbeat_{0};
 };
 
 int main(int argc, char** argv)
 {
-    if (argc != 4) {
+    logging::init();
+
+    constexpr size_t kDefaultPeerCount = 32;
+
+    bool netThread = false;
+    size_t peerCount = kDefaultPeerCount;
+    bool argsOk = argc >= 4;
+    for (int i = 4; argsOk && i < argc; ++i) {
+        std::string_view arg{argv[i]};
+        if (arg == "--net-thread") {
+            netThread = true;
+        } else if (arg == "--peers" && i + 1 < argc) {
+            peerCount = static_cast<size_t>(std::atoi(argv[++i]));
+            argsOk = peerCount >= 2 && peerCount <= ServerService::kMaxPeerCount;
+        } else {
+            argsOk = false;
+        }
+    }
+    if (!argsOk) {
         spdlog::error(
-            "Usage: {} <server port> <lobby address> <lobby port>\n", argv[0]);
+            "Usage: {} <server port> <lobby address> <lobby port> [--net-thread] "
+            "[--peers <2..{}>]\n",
+            argv[0],
+            ServerService::kMaxPeerCount);
         return -1;
     }
 
@@ -317,9 +432,17 @@ int main(int argc, char** argv)
         .port = static_cast<uint16_t>(std::atoi(argv[1])),
     };
 
-    ServerService server(address);
+    metrics::exportFromEnv("server");
+    profile::installSignalTrigger();
+
+    ServerService server(address, peerCount);
+    if (netThread) {
+        server.startNetworkThread();
+    }
 
-    server.registerInLobby(argv[2], static_cast<uint16_t>(std::atoi(argv[3])));
+    ENetAddress lobbyAddress{.port = static_cast<uint16_t>(std::atoi(argv[3]))};
+    enet_address_set_host(&lobbyAddress, argv[2]);
+    server.registerInLobby(lobbyAddress);
 
     server.run();
 
@@ -0,0 +1,285 @@
+#include <enet/enet.h>
+#include <spdlog/spdlog.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common/NetworkThread.hpp"
+#include "common/assert.hpp"
+
+using namespace std::chrono_literals;
+
+// NetworkThread against real ENet peers over loopback. Each case runs under a
+// watchdog, a deadlock fails rather than hangs.
+namespace {
+
+constexpr auto kTimeout = 60s;
+
+ENetPacket* numbered(uint32_t i)
+{
+    return enet_packet_create(&i, sizeof(i), ENET_PACKET_FLAG_RELIABLE);
+}
+
+uint32_t number(const ENetPacket* packet)
+{
+    uint32_t i;
+    NG_VERIFY(packet->dataLength == sizeof(i));
+    std::memcpy(&i, packet->data, sizeof(i));
+    return i;
+}
+
+// The other end, on its own thread and host: sends `flood` numbered messages
+// once connected and keeps whatever comes back
+class Remote {
+public:
+    explicit Remote(ENetAddress target, uint32_t flood = 0)
+        : host_{enet_host_create(nullptr, 1, 2, 0, 0)}, flood_{flood}
+    {
+        NG_VERIFY(host_ != nullptr);
+        peer_ = enet_host_connect(host_, &target, 2, 0);
+        NG_VERIFY(peer_ != nullptr);
+        worker_ = std::thread{[this]() { work(); }};
+    }
+
+    ~Remote()
+    {
+        stop();
+        enet_host_destroy(host_);
+    }
+
+    Remote(const Remote&) = delete;
+    Remote& operator=(const Remote&) = delete;
+
+    // Disconnects right away, the other side gets its event on the next service
+    void leave()
+    {
+        stop();
+        enet_peer_disconnect_now(peer_, 0);
+    }
+
+    bool connected() const { return connected_.load(); }
+    bool disconnected() const { return disconnected_.load(); }
+
+    std::vector<uint32_t> received()
+    {
+        std::lock_guard lock{mutex_};
+        return received_;
+    }
+
+private:
+    void stop()
+    {
+        stopped_.store(true);
+        if (worker_.joinable()) {
+            worker_.join();
+        }
+    }
+
+    void work()
+    {
+        while (!stopped_.load()) {
+            ENetEvent event;
+            if (enet_host_service(host_, &event, 1) <= 0)
+                continue;
+
+            switch (event.type) {
+                case ENET_EVENT_TYPE_CONNECT:
+                    connected_.store(true);
+                    for (uint32_t i = 0; i < flood_; ++i) {
+                        NG_VERIFY(enet_peer_send(event.peer, 0, numbered(i)) == 0);
+                    }
+                    break;
+
+                case ENET_EVENT_TYPE_RECEIVE: {
+                    std::lock_guard lock{mutex_};
+                    received_.push_back(number(event.packet));
+                    enet_packet_destroy(event.packet);
+                } break;
+
+                case ENET_EVENT_TYPE_DISCONNECT:
+                    disconnected_.store(true);
+                    break;
+
+                default:
+                    break;
+            }
+        }
+    }
+
+    ENetHost* host_;
+    ENetPeer* peer_;
+    uint32_t flood_;
+    std::thread worker_;
+    std::atomic<bool> stopped_{false};
+    std::atomic<bool> connected_{false};
+    std::atomic<bool> disconnected_{false};
+    std::mutex mutex_;
+    std::vector<uint32_t> received_;
+};
+
+// A host on an ephemeral port, and the address to reach it at
+ENetHost* listen(size_t peers, ENetAddress& target)
+{
+    ENetAddress address{.host = ENET_HOST_ANY, .port = 0};
+    auto* host = enet_host_create(&address, peers, 2, 0, 0);
+    NG_VERIFY(host != nullptr);
+
+    target = {.port = host->address.port};
+    NG_VERIFY(enet_address_set_host(&target, "127.0.0.1") == 0);
+    return host;
+}
+
+NetworkThread::Event popUntil(NetworkThread& net, ENetEventType type)
+{
+    NetworkThread::Event event;
+    while (true) {
+        if (!net.tryPop(event)) {
+            std::this_thread::sleep_for(1ms);
+            continue;
+        }
+        if (event.type == ENET_EVENT_TYPE_RECEIVE) {
+            enet_packet_destroy(event.packet);
+        }
+        if (event.type == type)
+            return event;
+    }
+}
+
+template<class F>
+void waitFor(F condition)
+{
+    while (!condition()) {
+        std::this_thread::sleep_for(1ms);
+    }
+}
+
+// Fills both queues at once: the peer floods us while the game thread is not
+// popping events, then the game thread pushes more sends than the command
+// queue holds. The network thread has to keep draining commands with the
+// event queue full, otherwise push never returns.
+void bothQueuesFull()
+{
+    // Well past the 4096 entries of either queue
+    constexpr uint32_t kMessages = 3 * 4096;
+
+    ENetAddress target;
+    auto* host = listen(1, target);
+    {
+        NetworkThread net{host};
+        Remote remote{target, kMessages};
+
+        auto connect = popUntil(net, ENET_EVENT_TYPE_CONNECT);
+
+        // Not popping: the event queue fills up and the rest waits behind it
+        std::this_thread::sleep_for(2s);
+
+        for (uint32_t i = 0; i < kMessages; ++i) {
+            net.push({
+                .kind = NetworkThread::Command::Kind::Send,
+                .peer = connect.peer,
+                .connectID = connect.connectID,
+                .channel = 0,
+                .packet = numbered(i),
+            });
+        }
+
+        uint32_t expected = 0;
+        NetworkThread::Event event;
+        while (expected < kMessages) {
+            if (!net.tryPop(event)) {
+                std::this_thread::sleep_for(1ms);
+                continue;
+            }
+            if (event.type == ENET_EVENT_TYPE_RECEIVE) {
+                NG_VERIFY(number(event.packet) == expected++);
+                enet_packet_destroy(event.packet);
+            }
+        }
+
+        waitFor([&]() { return remote.received().size() == kMessages; });
+        auto received = remote.received();
+        for (uint32_t i = 0; i < kMessages; ++i) {
+            NG_VERIFY(received[i] == i);
+        }
+    }
+    enet_host_destroy(host);
+    spdlog::info("Both queues full: {} messages each way went through", kMessages);
+}
+
+// The network thread handles a disconnect and hands the slot to a new
+// connection before the game thread has seen the disconnect. Whatever the
+// game thread still sends to (or disconnects) the old connection must not
+// reach the new one.
+void reusedSlot()
+{
+    ENetAddress target;
+    // One slot, so the second connection gets the first one's
+    auto* host = listen(1, target);
+    {
+        NetworkThread net{host};
+
+        Remote first{target};
+        auto old = popUntil(net, ENET_EVENT_TYPE_CONNECT);
+        first.leave();
+        std::this_thread::sleep_for(200ms);
+
+        Remote second{target};
+        waitFor([&]() { return second.connected(); });
+
+        // The game thread is still behind, as far as it knows this is `first`
+        net.push({
+            .kind = NetworkThread::Command::Kind::Send,
+            .peer = old.peer,
+            .connectID = old.connectID,
+            .channel = 0,
+            .packet = numbered(1),
+        });
+        net.push({
+            .kind = NetworkThread::Command::Kind::Disconnect,
+            .peer = old.peer,
+            .connectID = old.connectID,
+        });
+
+        auto current = popUntil(net, ENET_EVENT_TYPE_CONNECT);
+        NG_VERIFY(current.peer == old.peer);
+        NG_VERIFY(current.connectID != old.connectID);
+        net.push({
+            .kind = NetworkThread::Command::Kind::Send,
+            .peer = current.peer,
+            .connectID = current.connectID,
+            .channel = 0,
+            .packet = numbered(2),
+        });
+
+        waitFor([&]() { return !second.received().empty(); });
+        std::this_thread::sleep_for(200ms);
+        auto received = second.received();
+        NG_VERIFY(received.size() == 1 && received[0] == 2);
+        NG_VERIFY(!second.disconnected());
+    }
+    enet_host_destroy(host);
+    spdlog::info("Reused slot: commands for the old connection were dropped");
+}
+
+} // namespace
+
+int main()
+{
+    NG_VERIFY(enet_initialize() == 0);
+    std::atexit(enet_deinitialize);
+
+    std::thread{[]() {
+        std::this_thread::sleep_for(kTimeout);
+        spdlog::error("Timed out, the network thread is likely deadlocked");
+        std::_Exit(1);
+    }}.detach();
+
+    bothQueuesFull();
+    reusedSlot();
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include <enet/enet.h>
+#include <spdlog/spdlog.h>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+#include "common/Service.hpp"
+#include "common/assert.hpp"
+#include "common/proto.hpp"
+
+using namespace std::chrono_literals;
+
+// Service::poll in direct mode (no network thread) over loopback, under a
+// watchdog like NetworkThreadTest.
+namespace {
+
+constexpr auto kTimeout = 60s;
+
+class Receiver : public Service<Receiver, true> {
+public:
+    explicit Receiver(ENetAddress address)
+        : Service(&address, 1, 2)
+    {
+    }
+
+    void handlePacket(ENetPeer*, const PChat& packet)
+    {
+        lastPlayer = packet.player;
+        ++chats;
+    }
+
+    uint32_t lastPlayer{0};
+    size_t chats{0};
+};
+
+class Sender : public Service<Sender> {
+public:
+    Sender()
+        : Service(nullptr, 1, 2)
+    {
+    }
+};
+
+// A tick that overran: every poll starts with its deadline already gone
+void pastDeadline()
+{
+    ENetAddress address{.host = ENET_HOST_ANY, .port = 0};
+    Receiver receiver{address};
+    Sender sender;
+
+    ENetAddress target{.port = receiver.address().port};
+    NG_VERIFY(enet_address_set_host(&target, "127.0.0.1") == 0);
+
+    ENetPeer* peer = nullptr;
+    sender.connect(target, [&peer](ENetPeer* connected) {
+        NG_VERIFY(connected != nullptr);
+        peer = connected;
+    });
+    while (peer == nullptr) {
+        sender.poll(1);
+        receiver.poll(1);
+    }
+
+    sender.post(peer, 0, ENET_PACKET_FLAG_RELIABLE, PChat{.player = 42});
+
+    // Only polls that are late already: the message has to leave the sender
+    // and get read off the receiver's socket all the same
+    while (receiver.chats == 0) {
+        auto past = std::chrono::steady_clock::now() - 1s;
+        sender.poll(past);
+        receiver.poll(past);
+        std::this_thread::sleep_for(1ms);
+    }
+    NG_VERIFY(receiver.chats == 1 && receiver.lastPlayer == 42);
+    spdlog::info("Past deadline: a queued message was sent and received");
+}
+
+} // namespace
+
+int main()
+{
+    NG_VERIFY(enet_initialize() == 0);
+    std::atexit(enet_deinitialize);
+
+    std::thread{[]() {
+        std::this_thread::sleep_for(kTimeout);
+        spdlog::error("Timed out, poll does no I/O past its deadline");
+        std::_Exit(1);
+    }}.detach();
+
+    pastDeadline();
+    return 0;
+}